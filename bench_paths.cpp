@@ -0,0 +1,78 @@
+// Benchmark: validate_paths against a serial stat/access loop.
+// usage: options_bench_paths [directory] [file count] [threads]
+// Creates the files in directory if they aren't there yet, e.g. on a tmpfs
+// such as /dev/shm, and leaves them for the next run.
+#include "options.hpp"
+#include "options_paths.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+    const char *directory = argc > 1 ? argv[1] : "/dev/shm/options_bench_paths";
+    const long count = argc > 2 ? strtol(argv[2], nullptr, 10) : 1000000;
+    const unsigned threads = argc > 3 ? (unsigned)strtoul(argv[3], nullptr, 10) : 0;
+
+    mkdir(directory, 0755);
+
+    std::vector<std::string> paths;
+    paths.reserve((size_t)count);
+    for (long i = 0; i < count; ++i)
+    {
+        paths.push_back(std::string(directory) + "/file" + std::to_string(i));
+
+        struct stat st;
+        if (stat(paths.back().c_str(), &st) != 0)
+        {
+            int fd = open(paths.back().c_str(), O_CREAT | O_WRONLY, 0644);
+            if (fd < 0)
+            {
+                perror(paths.back().c_str());
+                return 1;
+            }
+            close(fd);
+        }
+    }
+
+    const options opts(paths);
+
+    // what a tool does today: one path after another
+    auto start = std::chrono::steady_clock::now();
+    size_t serial_found = 0;
+    for (const option &o : opts)
+    {
+        struct stat st;
+        if (stat(o.arg(), &st) == 0 && S_ISREG(st.st_mode) && access(o.arg(), R_OK) == 0)
+            ++serial_found;
+    }
+    double serial = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    std::vector<path_status> statuses = validate_paths(opts, threads);
+    double pooled = seconds_since(start);
+
+    size_t pooled_found = 0;
+    for (const path_status &status : statuses)
+    {
+        if (status.exists() && status.type == path_type::regular && status.readable)
+            ++pooled_found;
+    }
+
+    printf("%ld paths in %s\n", count, directory);
+    printf("serial loop:    %8.3f s, %zu valid\n", serial, serial_found);
+    printf("validate_paths: %8.3f s, %zu valid (%u threads, %u hardware)\n", pooled, pooled_found,
+           threads, std::thread::hardware_concurrency());
+    return serial_found == pooled_found ? 0 : 1;
+}
@@ -0,0 +1,36 @@
+/* ============================================================================
+    options.cpp
+
+    Compiles the definitions in options.hpp and its companion headers once,
+    for use with OPTIONS_COMPILED. Every translation unit that includes options.hpp must
+    define OPTIONS_COMPILED too, e.g. through the "options" CMake target.
+
+    MIT License
+    Copyright © 2022 Aaron Ishibashi
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the “Software”),
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+ * ========================================================================= */
+#ifndef OPTIONS_COMPILED
+#define OPTIONS_COMPILED
+#endif
+#define OPTIONS_IMPLEMENTATION
+#include "options.hpp"
+#include "options_cache.hpp"
+#include "options_paths.hpp"
+#include "options_reload.hpp"
@@ -0,0 +1,54 @@
+/* ============================================================================
+    options.cppm
+
+    C++20 module interface: `import options;` instead of including
+    options.hpp. Built by the options_module CMake target.
+
+    MIT License
+    Copyright © 2022 Aaron Ishibashi
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the “Software”),
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+ * ========================================================================= */
+module;
+#include "options.hpp"
+#include "options_cache.hpp"
+#include "options_paths.hpp"
+#include "options_reload.hpp"
+export module options;
+
+export using ::option_source;
+export using ::arg_errc;
+export using ::define_policy;
+export using ::arg_result;
+export using ::parse_traits;
+export using ::option;
+export using ::options;
+export using ::options_cache;
+export using ::path_type;
+export using ::path_status;
+export using ::validate_paths;
+export using ::static_options;
+export using ::arg_list;
+export using ::typed_arg_list;
+export using ::option_occurrences;
+export using ::argv_array;
+export using ::option_bindings;
+export using ::subcommand_router;
+export using ::frozen_options;
+export using ::reloadable_options;
@@ -2,6 +2,9 @@
     options.hpp
 
     Header-only file, containing classes for retrieving program options.
+    Define OPTIONS_COMPILED and link options.cpp to compile it once instead.
+    options_cache.hpp, options_paths.hpp and options_reload.hpp add the
+    classes that need heavier standard headers.
 
     MIT License
     Copyright © 2022 Aaron Ishibashi
@@ -27,55 +30,173 @@
 #pragma once
 #ifndef __options_hpp__
 #define __options_hpp__
+#include "options_fwd.hpp"
 #include <vector>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <cassert>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstddef>
+#include <iterator>
+#include <limits>
+#include <type_traits>
 #include <utility>
 #include <string>
 
+/// Out-of-line definitions are inline when header-only, and ordinary
+/// functions compiled once by options.cpp when OPTIONS_COMPILED is defined
+#if defined(OPTIONS_COMPILED)
+#define OPTIONS_INLINE
+#else
+#define OPTIONS_INLINE inline
+#endif
+
+/// Where an option's value came from. Sources are listed in order of
+/// precedence: argv overrides the environment, which overrides a config file.
+enum class option_source : unsigned char {
+    argv,        ///< command line
+    environment, ///< PREFIX_X environment variable
+    config_file  ///< key=value line in a config file
+};
+
+/// Why a typed arg lookup failed
+enum class arg_errc : unsigned char {
+    ok,           ///< no error
+    missing_flag, ///< no option has the flag
+    no_argument,  ///< the option has no arg
+    invalid,      ///< the arg is not a value of the requested type
+    out_of_range  ///< the arg is outside the requested type's range
+};
+
+/// Which of several defines with the same name options::get_define finds
+enum class define_policy : unsigned char {
+    last_wins, ///< the last one, as compilers do with -D
+    first_wins ///< the first one
+};
+
+/// The value of a typed arg lookup, or the reason there isn't one.
+/// Returned by options::parse_arg in place of errno and exceptions.
+template <typename T>
+class arg_result {
+public:
+    constexpr arg_result(T value) : m_value(value), m_err(arg_errc::ok) { }
+    constexpr arg_result(arg_errc err) : m_value(), m_err(err) { }
+
+    /// Parsed successfully
+    [[nodiscard]] constexpr bool ok() const { return m_err == arg_errc::ok; }
+    constexpr explicit operator bool() const { return ok(); }
+
+    /// arg_errc::ok, or why the lookup failed
+    [[nodiscard]] constexpr arg_errc error() const { return m_err; }
+
+    /// The parsed value; only meaningful if ok() is true
+    [[nodiscard]] constexpr const T &value() const { return m_value; }
+
+    /// @returns the parsed value, or fallback if there isn't one
+    [[nodiscard]] constexpr T value_or(T fallback) const { return ok() ? m_value : fallback; }
+
+private:
+    T m_value;
+    arg_errc m_err;
+};
+
 /// class representing a command line option.
 /// It can hold both a flag and an argument, and stores its index in the argv
 /// array.
 class option {
 public:
-    option() : m_index(-1), m_flag(), m_arg() { }
-    option(int index, char flag, const char *param) : m_index(index), m_flag(flag), m_arg(param) { }
+    constexpr option() :
+        m_index(-1), m_flag(), m_source(option_source::argv), m_terminated(true),
+        m_attached(false), m_arg(), m_arg_len(), m_flag_token(), m_flag_token_len() { }
+    constexpr option(int index, char flag, const char *param) :
+        option(index, flag, param, param ? std::char_traits<char>::length(param) : 0) { }
+
+    /// @param length length of param
+    /// @param terminated whether param[length] is '\0', and likewise for
+    /// flag_token. If not, only the string_view accessors may read them.
+    /// @param flag_token the token the flag was read from, if any
+    /// @param attached param is part of flag_token, as in "-Dname=value"
+    constexpr option(int index, char flag, const char *param, size_t length,
+           option_source source = option_source::argv, bool terminated = true,
+           std::string_view flag_token = std::string_view(), bool attached = false) :
+        m_index(index), m_flag(flag), m_source(source), m_terminated(terminated),
+        m_attached(attached), m_arg(param), m_arg_len(length),
+        m_flag_token(flag_token.data()), m_flag_token_len(flag_token.size()) { }
 
     /// Logs info to the output FILE * specified, default: stdout
     void log(FILE *output = stdout) const;
     
     // ========== Getters / Setters ==========
 
-    /// @returns argument c-string, or a nullptr if has_arg() is false
-    [[nodiscard]] const char *arg() const { return m_arg; }
+    /// @returns argument c-string, or a nullptr if has_arg() is false.
+    /// Only NUL-terminated if is_terminated() is true.
+    [[nodiscard]] constexpr const char *arg() const { return m_arg; }
+
+
+    /// @returns argument as a string_view, which is empty if has_arg() is false
+    [[nodiscard]] constexpr std::string_view arg_view() const
+    {
+        return m_arg ? std::string_view(m_arg, m_arg_len) : std::string_view();
+    }
+
+
+    /// @returns length of the argument, measured once at parse time
+    [[nodiscard]] constexpr size_t arg_size() const { return m_arg_len; }
 
 
     /// @returns the flag or '\0' if has_flag() is false
-    [[nodiscard]] char flag() const { return m_flag; }
+    [[nodiscard]] constexpr char flag() const { return m_flag; }
 
 
     /// The index in argv of the arg or flag, whichever came first.
-    [[nodiscard]] int index() const { return m_index; }
+    /// Options read from the environment or a config file have no argv
+    /// index and return -1.
+    [[nodiscard]] constexpr int index() const { return m_index; }
+
+
+    /// The layer this option was read from
+    [[nodiscard]] constexpr option_source source() const { return m_source; }
+
+
+    /// The arg is NUL-terminated, so arg() is a c-string. False only for
+    /// args parsed from views that aren't, e.g. into a shared buffer.
+    [[nodiscard]] constexpr bool is_terminated() const { return m_terminated; }
+
+
+    /// The whole token the flag was read from, e.g. "-O2" for flag 'O', or
+    /// an empty view if the option has no flag or was not parsed from argv
+    /// or a token range. NUL-terminated only if is_terminated() is true.
+    [[nodiscard]] constexpr std::string_view flag_token() const
+    {
+        return m_flag_token ? std::string_view(m_flag_token, m_flag_token_len) : std::string_view();
+    }
+
+
+    /// The arg was read from the flag token itself, as in "-Dname=value"
+    [[nodiscard]] constexpr bool has_attached_arg() const { return m_attached; }
 
 
     /// Has a parameter
-    [[nodiscard]] bool has_arg() const { return m_arg; }
+    [[nodiscard]] constexpr bool has_arg() const { return m_arg; }
 
 
     /// Has a flag
-    [[nodiscard]] bool has_flag() const { return m_flag; }
+    [[nodiscard]] constexpr bool has_flag() const { return m_flag; }
 
 
     /// Has only a parameter and no flag
-    [[nodiscard]] bool is_arg_only() const { return m_arg && !m_flag; }
+    [[nodiscard]] constexpr bool is_arg_only() const { return m_arg && !m_flag; }
 
 
     /// Has only a flag and no parameter
-    [[nodiscard]] bool is_flag_only() const { return m_flag && !m_arg; }
+    [[nodiscard]] constexpr bool is_flag_only() const { return m_flag && !m_arg; }
 
 
     /// Has both a flag and a paramter
-    [[nodiscard]] bool is_flagged_arg() const { return m_flag && m_arg; }
+    [[nodiscard]] constexpr bool is_flagged_arg() const { return m_flag && m_arg; }
 
 
 private:
@@ -85,12 +206,691 @@ private:
     /// flag or '\0', if none
     char m_flag;
 
+    /// layer the option was read from
+    option_source m_source;
+
+    /// m_arg and m_flag_token are followed by '\0'
+    bool m_terminated;
+
+    /// m_arg points into m_flag_token
+    bool m_attached;
+
     /// argument or nullptr, if none
     const char *m_arg;
+
+    /// length of m_arg, or 0 if none
+    size_t m_arg_len;
+
+    /// token the flag was read from, or nullptr, if none
+    const char *m_flag_token;
+    size_t m_flag_token_len;
+};
+
+namespace options_detail {
+    /// ASCII letters, which are the flags; unlike isalpha, not affected by
+    /// the locale, and usable in constant expressions
+    constexpr bool
+    is_alpha(unsigned char c)
+    {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    }
+
+    /// A flag token is '-' followed by a letter, e.g. "-o"
+    constexpr bool
+    is_flag_token(const char *token)
+    {
+        return token && token[0] == '-' && is_alpha((unsigned char)token[1]);
+    }
+
+    constexpr bool
+    is_flag_token(std::string_view token)
+    {
+        return token.size() >= 2 && token[0] == '-' && is_alpha((unsigned char)token[1]);
+    }
+
+    /// Tokens are read either as c-strings, measured while they are
+    /// fingerprinted, or as views whose length is already known. to_token
+    /// picks one for each supported token type.
+    constexpr const char *to_token(const char *token) { return token; }
+    constexpr std::string_view to_token(std::string_view token) { return token; }
+
+    /// std::string is NUL-terminated, so its args can be read as c-strings
+    inline const char *to_token(const std::string &token) { return token.c_str(); }
+
+    /// a (pointer, length) pair
+    template <typename Char>
+    constexpr std::string_view
+    to_token(const std::pair<Char *, size_t> &token)
+    {
+        return std::string_view(token.first, token.second);
+    }
+
+    constexpr const char *token_data(const char *token) { return token; }
+    constexpr const char *token_data(std::string_view token) { return token.data() ? token.data() : ""; }
+
+    /// The rest of a flag token after the flag, e.g. "2" in "-O2". For the
+    /// define flag it is the attached arg, "name=value" in "-Dname=value".
+    constexpr bool has_attached_arg(const char *flag_token) { return flag_token[2] != '\0'; }
+    constexpr bool has_attached_arg(std::string_view flag_token) { return flag_token.size() > 2; }
+    constexpr const char *after_flag(const char *flag_token) { return flag_token + 2; }
+    constexpr std::string_view after_flag(std::string_view flag_token) { return flag_token.substr(2); }
+
+    /// see options::define_flag
+    constexpr char define_flag = 'D';
+
+    /// What one step of tokenizing reads: an arg with no flag, a flag alone,
+    /// a flag with its arg attached, or a flag paired with the next token
+    template <typename Token>
+    struct paired_token {
+        char flag;          // '\0' for an arg with no flag
+        Token arg;          // valid if has_arg
+        bool has_arg;
+        bool attached;      // arg is the rest of the flag token
+        bool consumed_next; // arg is the next token, which is used up
+    };
+
+    /// Classifies the token at first and pairs it with the next one, the
+    /// rules every tokenizer follows: a flag token takes the next token as
+    /// its arg unless that is a flag too, and the define flag may carry its
+    /// arg attached, "-Dname=value".
+    template <typename Iterator>
+    constexpr paired_token<decltype(to_token(*std::declval<Iterator>()))>
+    pair_token(Iterator first, Iterator last)
+    {
+        typedef decltype(to_token(*first)) token_type;
+        token_type token = to_token(*first);
+        paired_token<token_type> paired {'\0', token_type(), false, false, false};
+
+        if (!is_flag_token(token))                     // arg has no flag
+        {
+            paired.arg = token;
+            paired.has_arg = true;
+            return paired;
+        }
+
+        paired.flag = token_data(token)[1];
+        Iterator next = std::next(first);
+        if (paired.flag == define_flag && has_attached_arg(token)) // "-Dname=value"
+        {
+            paired.arg = after_flag(token);
+            paired.has_arg = true;
+            paired.attached = true;
+        }
+        else if (next != last && !is_flag_token(to_token(*next))) // flag paired with arg
+        {
+            paired.arg = to_token(*next);
+            paired.has_arg = true;
+            paired.consumed_next = true;
+        }
+        return paired;
+    }
+
+    /// A range whose elements to_token accepts
+    template <typename Range, typename = void>
+    struct is_token_range : std::false_type { };
+
+    template <typename Range>
+    struct is_token_range<Range, std::void_t<
+        decltype(to_token(*std::begin(std::declval<const Range &>()))),
+        decltype(std::end(std::declval<const Range &>()))>> : std::true_type { };
+
+    /// Skips the leading whitespace and '+' sign that strtol accepts, but
+    /// std::from_chars does not
+    constexpr const char *
+    skip_number_prefix(const char *first, const char *last)
+    {
+        while (first != last && (*first == ' ' || (*first >= '\t' && *first <= '\r')))
+            ++first;
+        if (first != last && *first == '+' && last - first > 1 && first[1] != '-')
+            ++first;
+        return first;
+    }
+
+    /// Parses a base-10 integer from the start of an arg, like strtol.
+    /// A plain loop rather than std::from_chars, so that it works in
+    /// constant expressions too.
+    template <typename T>
+    constexpr arg_result<T>
+    parse_integer(std::string_view arg)
+    {
+        const char *last = arg.data() + arg.size();
+        const char *first = skip_number_prefix(arg.data(), last);
+
+        bool negative = false;
+        if constexpr (std::is_signed_v<T>)
+        {
+            if (first != last && *first == '-')
+            {
+                negative = true;
+                ++first;
+            }
+        }
+
+        if (first == last || *first < '0' || *first > '9')
+            return arg_errc::invalid;
+
+        // accumulate toward the sign, so that the minimum of T fits
+        T value = 0;
+        bool out_of_range = false;
+        for (; first != last && *first >= '0' && *first <= '9'; ++first)
+        {
+            T digit = (T)(*first - '0');
+            if (negative)
+            {
+                if (value < (std::numeric_limits<T>::min() + digit) / 10)
+                    out_of_range = true;
+                else
+                    value = (T)(value * 10 - digit);
+            }
+            else
+            {
+                if (value > (std::numeric_limits<T>::max() - digit) / 10)
+                    out_of_range = true;
+                else
+                    value = (T)(value * 10 + digit);
+            }
+        }
+
+        if (out_of_range)
+            return arg_errc::out_of_range;
+        return value;
+    }
+
+    /// A hex digit or '.', which may follow the "0x" of a hex float
+    constexpr bool
+    is_hex_float_start(char c)
+    {
+        return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F') || c == '.';
+    }
+
+    /// Parses a floating point number from the start of an arg, like strtod,
+    /// including the "0x" hex form. Defined for float, double and long double
+    /// with the other definitions, so that this header doesn't pull in
+    /// <charconv>.
+    template <typename T>
+    arg_result<T> parse_floating(std::string_view arg);
+
+    template <>
+    arg_result<float> parse_floating<float>(std::string_view arg);
+    template <>
+    arg_result<double> parse_floating<double>(std::string_view arg);
+    template <>
+    arg_result<long double> parse_floating<long double>(std::string_view arg);
+
+    /// Unpacks a result into a get_arg style out parameter, setting errno to
+    /// EINVAL or ERANGE if the arg did not parse
+    template <typename T>
+    inline bool
+    unwrap(const arg_result<T> &result, T *val)
+    {
+        if (result)
+        {
+            *val = result.value();
+            return true;
+        }
+
+        if (result.error() == arg_errc::invalid)
+            errno = EINVAL;
+        else if (result.error() == arg_errc::out_of_range)
+            errno = ERANGE;
+        return false;
+    }
+
+    /// options::fingerprint is 64-bit FNV-1a over each option's flag, source
+    /// and whether it has an arg; then, if it has a flag, the rest of its
+    /// flag token and a terminator; then the arg's bytes and terminator
+    constexpr uint64_t fingerprint_basis = 14695981039346656037ULL;
+    constexpr uint64_t fingerprint_prime = 1099511628211ULL;
+
+    /// Extends a fingerprint with the fixed-size part of an option
+    inline uint64_t
+    fingerprint_header(uint64_t h, char flag, option_source source, bool has_arg)
+    {
+        h = (h ^ (unsigned char)flag) * fingerprint_prime;
+        h = (h ^ (unsigned char)source) * fingerprint_prime;
+        return (h ^ (has_arg ? 1u : 0u)) * fingerprint_prime;
+    }
+
+    /// Extends a fingerprint with a NUL-terminated arg or token, measuring it
+    /// in the same pass
+    /// @returns the length of arg
+    inline size_t
+    fingerprint_arg(uint64_t *h, const char *arg)
+    {
+        uint64_t x = *h;
+        const char *p = arg;
+        for (; *p; ++p)
+            x = (x ^ (unsigned char)*p) * fingerprint_prime;
+        *h = x * fingerprint_prime; // the terminator
+        return (size_t)(p - arg);
+    }
+
+    /// Extends a fingerprint with an arg of known length
+    inline uint64_t
+    fingerprint_arg(uint64_t h, std::string_view arg)
+    {
+        for (char c : arg)
+            h = (h ^ (unsigned char)c) * fingerprint_prime;
+        return h * fingerprint_prime;
+    }
+
+    /// Extends a fingerprint with an arg of known length
+    /// @returns the length of arg
+    inline size_t
+    fingerprint_arg(uint64_t *h, std::string_view arg)
+    {
+        *h = fingerprint_arg(*h, arg);
+        return arg.size();
+    }
+
+    /// The rest of an option's flag token after the flag, which is empty
+    /// for a flag added by editing or read from the environment or a config
+    /// file: they are emitted as "-x"
+    constexpr std::string_view
+    flag_token_rest(const option &o)
+    {
+        return o.flag_token().size() > 2 ? o.flag_token().substr(2) : std::string_view();
+    }
+
+    /// Extends a fingerprint with a whole option, as parse_tokens does
+    inline uint64_t
+    fingerprint_option(uint64_t h, const option &o)
+    {
+        h = fingerprint_header(h, o.flag(), o.source(), o.has_arg());
+        if (o.has_flag())
+            h = fingerprint_arg(h, flag_token_rest(o));
+        if (o.has_arg())
+            h = fingerprint_arg(h, o.arg_view());
+        return h;
+    }
+
+    /// Storage an options container shares with its copies: the config
+    /// file it read, the strings added by editing, and the index of its
+    /// defines. Defined with the other definitions, so that this header
+    /// doesn't pull in <atomic> for their reference counts.
+    class config_file;
+    class string_arena;
+    class define_cache;
+    struct define_index;
+
+    /// Add and drop a reference; the last one deletes the storage
+    void retain(const config_file *storage) noexcept;
+    void release(const config_file *storage) noexcept;
+    void retain(const string_arena *storage) noexcept;
+    void release(const string_arena *storage) noexcept;
+    void retain(const define_cache *storage) noexcept;
+    void release(const define_cache *storage) noexcept;
+
+    /// A counted reference to shared storage, like std::shared_ptr but
+    /// without <memory>. Copies may be made and dropped on any thread.
+    template <typename T>
+    class shared_ref {
+    public:
+        constexpr shared_ref() noexcept : m_ptr(nullptr) { }
+
+        /// Adopts newly allocated storage, which starts with one reference
+        explicit shared_ref(T *ptr) noexcept : m_ptr(ptr) { }
+
+        shared_ref(const shared_ref &other) noexcept : m_ptr(other.m_ptr)
+        {
+            if (m_ptr)
+                retain(m_ptr);
+        }
+
+        shared_ref(shared_ref &&other) noexcept : m_ptr(other.m_ptr) { other.m_ptr = nullptr; }
+
+        ~shared_ref()
+        {
+            if (m_ptr)
+                release(m_ptr);
+        }
+
+        shared_ref &operator=(shared_ref other) noexcept
+        {
+            swap(other);
+            return *this;
+        }
+
+        void swap(shared_ref &other) noexcept { std::swap(m_ptr, other.m_ptr); }
+
+        [[nodiscard]] T *get() const { return m_ptr; }
+        T *operator->() const { return m_ptr; }
+        explicit operator bool() const { return m_ptr != nullptr; }
+
+    private:
+        T *m_ptr;
+    };
+
+    /// A heap copy of a value of any copyable type, e.g. a binding's default.
+    /// Copying it copies the value.
+    class any_value {
+    public:
+        any_value() noexcept : m_value(), m_copy(), m_destroy() { }
+
+        template <typename T>
+        explicit any_value(T value) :
+            m_value(new T(std::move(value))), m_copy(&copy<T>), m_destroy(&destroy<T>) { }
+
+        any_value(const any_value &other) :
+            m_value(other.m_value ? other.m_copy(other.m_value) : nullptr),
+            m_copy(other.m_copy), m_destroy(other.m_destroy) { }
+
+        any_value(any_value &&other) noexcept :
+            m_value(other.m_value), m_copy(other.m_copy), m_destroy(other.m_destroy)
+        {
+            other.m_value = nullptr;
+        }
+
+        ~any_value()
+        {
+            if (m_value)
+                m_destroy(m_value);
+        }
+
+        any_value &operator=(any_value other) noexcept
+        {
+            std::swap(m_value, other.m_value);
+            std::swap(m_copy, other.m_copy);
+            std::swap(m_destroy, other.m_destroy);
+            return *this;
+        }
+
+        [[nodiscard]] const void *get() const { return m_value; }
+
+    private:
+        template <typename T>
+        static void *copy(const void *value) { return new T(*static_cast<const T *>(value)); }
+
+        template <typename T>
+        static void destroy(void *value) { delete static_cast<T *>(value); }
+
+        void *m_value;
+        void *(*m_copy)(const void *value);
+        void (*m_destroy)(void *value);
+    };
+}
+
+/// Converts an arg to a T for options::parse_arg and get_arg.
+/// Specialize it to read your own types with a single flag lookup:
+///
+///     template <>
+///     struct parse_traits<ipv4> {
+///         static arg_result<ipv4> parse(std::string_view arg);
+///     };
+///
+/// parse receives the arg of the first option with the flag, and is only
+/// called if there is one.
+template <typename T, typename Enable>
+struct parse_traits;
+
+template <>
+struct parse_traits<std::string_view> {
+    static constexpr arg_result<std::string_view> parse(std::string_view arg) { return arg; }
+};
+
+/// The view's data is the c-string, so arg must be NUL-terminated. options
+/// only calls this for args whose option::is_terminated() is true, and
+/// reports arg_errc::invalid for the others.
+template <>
+struct parse_traits<const char *> {
+    static constexpr arg_result<const char *> parse(std::string_view arg) { return arg.data(); }
+};
+
+/// Any integer type but bool, in base 10. Leading whitespace and a '+' sign
+/// are skipped, and parsing stops at the first non-digit, as with strtol.
+template <typename T>
+struct parse_traits<T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>>> {
+    static constexpr arg_result<T> parse(std::string_view arg)
+    {
+        return options_detail::parse_integer<T>(arg);
+    }
+};
+
+/// float, double and long double, as with strtod
+template <typename T>
+struct parse_traits<T, std::enable_if_t<std::is_floating_point_v<T>>> {
+    static arg_result<T> parse(std::string_view arg)
+    {
+        return options_detail::parse_floating<T>(arg);
+    }
+};
+
+/// "1", "0", "true", "false", "yes" or "no"
+template <>
+struct parse_traits<bool> {
+    static constexpr arg_result<bool> parse(std::string_view arg)
+    {
+        arg_result<long> l = options_detail::parse_integer<long>(arg);
+        if (l)
+        {
+            if (l.value() == 0 || l.value() == 1)
+                return l.value() == 1;
+            return arg_errc::out_of_range;
+        }
+        if (l.error() == arg_errc::out_of_range)
+            return arg_errc::out_of_range;
+
+        if (arg == "true" || arg == "yes")
+            return true;
+        if (arg == "false" || arg == "no")
+            return false;
+        return arg_errc::invalid;
+    }
+};
+
+/// Lazy range over the delimited segments of an arg, e.g. "a", "b" and "c"
+/// in "-I a,b,c". Segments are string_views into the arg itself, so iterating
+/// allocates and copies nothing. Each delimiter is found with memchr, which
+/// standard libraries vectorize, so long lists are scanned many bytes at a time.
+/// An empty arg has one empty segment; a missing arg has none.
+class arg_list {
+public:
+    class iterator {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::string_view value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const std::string_view *pointer;
+        typedef const std::string_view &reference;
+
+        /// end iterator
+        iterator() : m_segment(), m_next(), m_last(), m_delim(), m_at_end(true) { }
+
+        iterator(std::string_view arg, char delim) :
+            m_segment(), m_next(arg.data()), m_last(arg.data() + arg.size()),
+            m_delim(delim), m_at_end(false)
+        {
+            advance();
+        }
+
+        reference operator*() const { return m_segment; }
+        pointer operator->() const { return &m_segment; }
+
+        iterator &operator++() { advance(); return *this; }
+        iterator operator++(int) { iterator prev = *this; advance(); return prev; }
+
+        bool operator==(const iterator &other) const
+        {
+            return m_at_end == other.m_at_end &&
+                (m_at_end || m_segment.data() == other.m_segment.data());
+        }
+        bool operator!=(const iterator &other) const { return !(*this == other); }
+
+    private:
+        void advance()
+        {
+            if (!m_next)
+            {
+                m_at_end = true;
+                m_segment = std::string_view();
+                return;
+            }
+
+            auto delim = static_cast<const char *>(
+                memchr(m_next, m_delim, (size_t)(m_last - m_next)));
+            if (delim)
+            {
+                m_segment = std::string_view(m_next, (size_t)(delim - m_next));
+                m_next = delim + 1;
+            }
+            else                                // last segment
+            {
+                m_segment = std::string_view(m_next, (size_t)(m_last - m_next));
+                m_next = nullptr;
+            }
+        }
+
+        std::string_view m_segment;
+
+        /// start of the next segment, or nullptr after the last one
+        const char *m_next;
+        const char *m_last;
+        char m_delim;
+        bool m_at_end;
+    };
+
+    /// empty list
+    arg_list() : m_arg(), m_delim(), m_has_arg(false) { }
+    arg_list(std::string_view arg, char delim) :
+        m_arg(arg), m_delim(delim), m_has_arg(true) { }
+
+    [[nodiscard]] iterator begin() const { return m_has_arg ? iterator(m_arg, m_delim) : iterator(); }
+    [[nodiscard]] iterator end() const { return iterator(); }
+
+    /// Has no segments, i.e. there was no arg to split
+    [[nodiscard]] bool empty() const { return !m_has_arg; }
+
+private:
+    std::string_view m_arg;
+    char m_delim;
+    bool m_has_arg;
+};
+
+/// Lazy range that converts each segment of an arg_list to a T through
+/// parse_traits<T> as it is visited, yielding an arg_result<T> per segment.
+template <typename T>
+class typed_arg_list {
+    static_assert(!std::is_same_v<T, const char *>,
+                  "segments are not NUL-terminated; use arg_list for string_views");
+
+public:
+    class iterator {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef arg_result<T> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const arg_result<T> *pointer;
+        typedef arg_result<T> reference;
+
+        iterator() : m_it() { }
+        explicit iterator(arg_list::iterator it) : m_it(it) { }
+
+        reference operator*() const { return parse_traits<T>::parse(*m_it); }
+
+        iterator &operator++() { ++m_it; return *this; }
+        iterator operator++(int) { iterator prev = *this; ++m_it; return prev; }
+
+        bool operator==(const iterator &other) const { return m_it == other.m_it; }
+        bool operator!=(const iterator &other) const { return m_it != other.m_it; }
+
+    private:
+        arg_list::iterator m_it;
+    };
+
+    typed_arg_list() : m_list() { }
+    explicit typed_arg_list(arg_list list) : m_list(list) { }
+
+    [[nodiscard]] iterator begin() const { return iterator(m_list.begin()); }
+    [[nodiscard]] iterator end() const { return iterator(m_list.end()); }
+    [[nodiscard]] bool empty() const { return m_list.empty(); }
+
+private:
+    arg_list m_list;
+};
+
+/// Range over every option with one flag, in argv order. Iterating it only
+/// touches those options.
+class option_occurrences {
+public:
+    class iterator {
+    public:
+        typedef std::random_access_iterator_tag iterator_category;
+        typedef option value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const option *pointer;
+        typedef const option &reference;
+
+        iterator() : m_opts(), m_index() { }
+        iterator(const option *opts, const int *index) : m_opts(opts), m_index(index) { }
+
+        reference operator*() const { return m_opts[*m_index]; }
+        pointer operator->() const { return &m_opts[*m_index]; }
+        reference operator[](difference_type n) const { return m_opts[m_index[n]]; }
+
+        iterator &operator++() { ++m_index; return *this; }
+        iterator operator++(int) { iterator prev = *this; ++m_index; return prev; }
+        iterator &operator--() { --m_index; return *this; }
+        iterator operator--(int) { iterator prev = *this; --m_index; return prev; }
+        iterator &operator+=(difference_type n) { m_index += n; return *this; }
+        iterator &operator-=(difference_type n) { m_index -= n; return *this; }
+        iterator operator+(difference_type n) const { return iterator(m_opts, m_index + n); }
+        iterator operator-(difference_type n) const { return iterator(m_opts, m_index - n); }
+        difference_type operator-(const iterator &other) const { return m_index - other.m_index; }
+
+        bool operator==(const iterator &other) const { return m_index == other.m_index; }
+        bool operator!=(const iterator &other) const { return m_index != other.m_index; }
+        bool operator<(const iterator &other) const { return m_index < other.m_index; }
+
+    private:
+        const option *m_opts;
+        const int *m_index;
+    };
+
+    option_occurrences(const option *opts, const int *first, const int *last) :
+        m_opts(opts), m_first(first), m_last(last) { }
+
+    [[nodiscard]] iterator begin() const { return iterator(m_opts, m_first); }
+    [[nodiscard]] iterator end() const { return iterator(m_opts, m_last); }
+    [[nodiscard]] size_t size() const { return (size_t)(m_last - m_first); }
+    [[nodiscard]] bool empty() const { return m_first == m_last; }
+    [[nodiscard]] const option &operator[](size_t n) const { return m_opts[m_first[n]]; }
+
+private:
+    const option *m_opts;
+    const int *m_first;
+    const int *m_last;
+};
+
+/// A NUL-terminated argv array, e.g. for posix_spawn or execv, made by
+/// options::to_argv. The pointer array is one allocation; the strings it
+/// points to are the options' own tokens where they are NUL-terminated, and
+/// the array keeps any of them that an options container owns alive.
+class argv_array {
+public:
+    argv_array() : m_argv(), m_argc(), m_config(), m_arena() { }
+
+    /// @returns number of args, not counting the terminating nullptr
+    [[nodiscard]] int argc() const { return m_argc; }
+
+    /// @returns the args followed by nullptr. The strings must not be
+    /// modified; the type matches what spawn and exec functions take.
+    [[nodiscard]] char *const *argv() const { return m_argv.empty() ? nullptr : m_argv.data(); }
+
+private:
+    friend class options;
+
+    std::vector<char *> m_argv;
+    int m_argc;
+    options_detail::shared_ref<options_detail::config_file> m_config;
+    options_detail::shared_ref<options_detail::string_arena> m_arena;
 };
 
 /// Class wrapping a vector of option objects.
 /// Manages the parsing of command line args.
+/// Const member functions never modify the container, but the typed get_arg
+/// overloads report errors through errno, and the first get_define builds an
+/// index (safely, even when threads race to do it). See frozen_options for a
+/// snapshot meant to be shared between threads.
 class options {
 public:
     typedef const option *const_iterator;
@@ -98,7 +898,51 @@ public:
     /// @param argc argument count
     /// @param argv array of c-string args
     options(int argc, char *argv[]);
-    options() : m_opts() {}
+
+    /// Reads options from argv, then the environment, then a config file.
+    /// Every layer's options are stored in this container in that order, and
+    /// lookups resolve to the first one found, so argv takes precedence over
+    /// the environment, which takes precedence over the config file.
+    /// @param argc argument count
+    /// @param argv array of c-string args
+    /// @param env_prefix environment variable prefix, e.g. "APP" reads flag
+    /// 'o' from "APP_o". An empty variable is a flag without an arg. Pass
+    /// nullptr to skip the environment.
+    /// @param config_path path of a config file containing "x=value" lines,
+    /// where x is the flag. A line with no '=' or an empty value is a flag
+    /// without an arg; blank lines and lines starting with '#' are ignored.
+    /// Pass nullptr to skip it. A missing or unreadable file is skipped.
+    options(int argc, char *argv[], const char *env_prefix,
+            const char *config_path = nullptr);
+
+    /// Reads options from a range of tokens, without building an argv array:
+    /// e.g. a std::vector<std::string>, an array of std::string_views into a
+    /// flat buffer, or of std::pair<const char *, size_t>. Tokens are paired
+    /// as argv is, and an option's index is its token's position.
+    /// Args point into the tokens, so the range's elements must outlive this
+    /// container, and temporary ranges are rejected. Args from string_views
+    /// and pairs are not NUL-terminated (option::is_terminated() is false):
+    /// read them through arg_view or typed lookups. c-string lookups of
+    /// them fail with arg_errc::invalid, and to_argv copies them.
+    /// @param tokens a forward range, e.g. any standard container
+    template <typename Range,
+              typename = std::enable_if_t<options_detail::is_token_range<Range>::value>>
+    explicit options(const Range &tokens);
+
+    template <typename Range,
+              typename = std::enable_if_t<options_detail::is_token_range<Range>::value>>
+    options(const Range &&tokens) = delete;
+
+    options() :
+        m_opts(), m_offsets(), m_grouped(), m_layer_ends(), m_config(), m_arena(),
+        m_fingerprint(options_detail::fingerprint_basis), m_defines() { }
+
+    options(const options &) = default;
+    options &operator=(const options &) = default;
+
+    /// Moves the options out of other, which is left empty
+    options(options &&other) noexcept;
+    options &operator=(options &&other) noexcept;
 
     /// Swaps the guts of this options container with another.
     void swap(options &other);
@@ -108,8 +952,65 @@ public:
     void log(FILE *output = stdout) const;
     
 
+    // ========== Editing ==========
+
+    /// Removes every option with a flag. This can leave a flag without an
+    /// arg right before an arg-only option, which would read as a pair if
+    /// parsed again: see to_argv.
+    /// @returns the number of options removed
+    size_t remove(char flag);
+
+
+    /// Sets a flag's arg, leaving exactly one option with the flag. The first
+    /// option with the flag keeps its place and flag token, unless its old
+    /// arg was part of the token; if there is none, one is appended. arg is
+    /// copied into a small arena owned by this container.
+    void set_arg(char flag, std::string_view arg);
+
+
+    /// Inserts an option before position pos, or appends if pos >= size().
+    /// Inserted options have no argv index.
+    /// @param flag the flag, or '\0' for an arg-only option
+    /// @param arg the arg, copied into a small arena owned by this container
+    void insert(size_t pos, char flag, std::string_view arg);
+
+
+    /// Inserts a flag-only option before position pos, or appends if
+    /// pos >= size().
+    void insert(size_t pos, char flag);
+
+
+    /// Emits the options as an argv array, e.g. to spawn a child process.
+    /// Parsed flags and args are reused by pointer, as the tokens they were
+    /// read from, e.g. "-O2" or "-Dname=value". Flags added by editing, or
+    /// read from the environment or a config file, point into a static table
+    /// of "-x" strings. So only the pointer array is allocated, unless tokens
+    /// aren't NUL-terminated, which are copied.
+    /// Fails if the child would pair the tokens differently from these
+    /// options, which only editing can cause: a flag without an arg right
+    /// before an arg-only option, e.g. "-f -o out file" after remove('o')
+    /// reads "file" as the arg of -f; an arg that reads as a flag, e.g.
+    /// set_arg('o', "-x"); or a flag that isn't a letter.
+    /// @param argv [out] receives the array, unless this fails
+    /// @returns true if the child would read the same options
+    bool to_argv(argv_array *argv) const;
+
+
     // ========== Getters & Querying ==========
-    
+
+    /// @returns a 64-bit fingerprint of the options: each one's whole flag
+    /// token, e.g. "-O2", source and arg, in order. It is computed in the same pass that tokenizes
+    /// them, and kept up to date by editing. Equal options have equal
+    /// fingerprints in every run and on every platform. Different options
+    /// almost always differ, but it is not a cryptographic hash: compare the
+    /// options themselves where a collision would matter.
+    [[nodiscard]] uint64_t fingerprint() const { return m_fingerprint; }
+
+
+    /// @returns the fingerprint options(argc, argv) would have, without
+    /// allocating
+    [[nodiscard]] static uint64_t fingerprint(int argc, char *argv[]);
+
     /// Finds the first option with a particular flag
     /// @param flag the flag to check
     /// @param opt [out] the option to receive
@@ -117,7 +1018,39 @@ public:
     bool get_option(char flag, option *opt) const;
 
 
-    /// Finds multiple options with the same flag
+    /// Finds the nth option with a particular flag, in argv order.
+    /// This and the other occurrence lookups below only see the layer with
+    /// the highest precedence that has the flag, e.g. argv occurrences
+    /// hide those in the environment and config file.
+    /// @param flag the flag to check
+    /// @param n which occurrence to get, starting at 0
+    /// @param opt [out] the option to receive
+    /// @returns true if there are more than n options with the flag in its
+    /// first layer
+    bool get_option(char flag, size_t n, option *opt) const;
+
+
+    /// Finds the last option with a particular flag, for when later options
+    /// should override earlier ones. A later layer never overrides an
+    /// earlier one: with "-o a" in argv and "o=b" in the config file, this
+    /// finds "a".
+    /// @param flag the flag to check
+    /// @param opt [out] the option to receive
+    /// @returns true if one was found, false if there was none
+    bool get_last_option(char flag, option *opt) const;
+
+
+    /// @returns the number of options with a particular flag in its first
+    /// layer, e.g. 3 for 'v' in "-v -v -v"
+    [[nodiscard]] size_t count(char flag) const;
+
+
+    /// @returns every option with a particular flag in its first layer, in
+    /// argv order, without copying them
+    [[nodiscard]] option_occurrences occurrences(char flag) const;
+
+
+    /// Finds multiple options with the same flag, from every layer
     /// @param flag the flag to check
     /// @param opt [out] the option to receive
     /// @returns true if at least one option with flag was found, false if
@@ -133,10 +1066,19 @@ public:
     bool get_arg(char flag, const char **param) const;
 
 
-    /// Finds the arg of the first option with a specified flag
+    /// Finds the arg of the first option with a specified flag, without
+    /// measuring it again
     /// @param flag the flag to check
-    /// @param val [out] the value to get
-    /// @returns true if parameter was found and parsed correctly, false if no such
+    /// @param param [out] the parameter to receive
+    /// @returns true if parameter was found, false if there was either a missing option,
+    /// or the option found did not have an arg.
+    bool get_arg(char flag, std::string_view *param) const;
+
+
+    /// Finds the arg of the first option with a specified flag
+    /// @param flag the flag to check
+    /// @param val [out] the value to get
+    /// @returns true if parameter was found and parsed correctly, false if no such
     /// option exists, the option found did not have a readable long value,
     /// or the option found did not have an arg at all.
     /// Check errno == EINVAL for invalid number, or errno == ERANGE for out of range
@@ -164,15 +1106,84 @@ public:
     /// out parameter.
     bool get_arg(char flag, bool *val) const;
 
-    /// TODO: Implement get_arg(char flag, double *val) const and float versions.
+    /// Finds the floating point arg of the first option with a specified flag
+    /// @param flag the flag to check
+    /// @param val [out] the value to get
+    /// @returns true if parameter was found and parsed correctly, false if no such
+    /// option exists, the option found did not have a readable value,
+    /// or the option found did not have an arg at all.
+    /// Check errno == EINVAL for invalid number, or errno == ERANGE for out of range
     bool get_arg(char flag, long double *val) const;
     bool get_arg(char flag, double *val) const;
     bool get_arg(char flag, float *val) const;
 
+
+    /// Finds and converts the arg of the first option with a specified flag
+    /// to any type with a parse_traits specialization. The overloads above
+    /// are instantiations of this.
+    /// @param flag the flag to check
+    /// @param val [out] the value to get
+    /// @returns true if parameter was found and parsed correctly.
+    /// Check errno == EINVAL for invalid value, or errno == ERANGE for out of range
+    template <typename T>
+    bool get_arg(char flag, T *val) const;
+
+
+    /// Splits the arg of the first option with a specified flag, without
+    /// copying it. "-I a,b,c" gives "a", "b" and "c".
+    /// @param flag the flag to check
+    /// @param delim the delimiter between segments
+    /// @returns a lazy range of string_views into the arg, empty if the flag
+    /// is missing or has no arg
+    [[nodiscard]] arg_list get_list(char flag, char delim = ',') const;
+
+
+    /// Splits the arg of the first option with a specified flag, and converts
+    /// each segment to a T through parse_traits<T> as it is visited.
+    /// "-c 0:2:4" with T = int and delim = ':' gives 0, 2 and 4.
+    /// @returns a lazy range of arg_result<T>, empty if the flag is missing
+    /// or has no arg
+    template <typename T>
+    [[nodiscard]] typed_arg_list<T> get_list(char flag, char delim = ',') const;
+
+
+    /// Finds and converts the arg of the first option with a specified flag,
+    /// without writing errno or throwing. Every get_arg wraps this.
+    /// T is any type with a parse_traits specialization: const char *,
+    /// std::string_view, bool, integers and floating point types are built in.
+    /// @param flag the flag to check
+    /// @returns the value, or arg_errc::missing_flag, no_argument, invalid
+    /// or out_of_range
+    template <typename T>
+    [[nodiscard]] arg_result<T> parse_arg(char flag) const;
+
     /// Checks if this container has an option with an indicated flag.
     [[nodiscard]] bool has_flag(char flag) const;
 
 
+    /// The flag of define-style options, "-Dname=value" or "-D name=value".
+    /// Unlike other flags, its token may carry its arg after the flag.
+    static constexpr char define_flag = options_detail::define_flag;
+
+
+    /// Finds a define by name, e.g. "name" in "-Dname=value", without
+    /// copying. The first lookup builds a hash index of every define, so the
+    /// rest take constant time; it is rebuilt after editing. Safe to call
+    /// from several threads at once.
+    /// @param name the part of the arg before the first '='
+    /// @param value [out] the part after it, which is empty for "-Dname"
+    /// @param policy which of several defines with the same name to find.
+    /// Either way, argv takes precedence over the environment and config
+    /// file: last_wins picks the last one from the first layer defining it.
+    /// @returns true if name is defined
+    bool get_define(std::string_view name, std::string_view *value,
+                    define_policy policy = define_policy::last_wins) const;
+
+
+    /// Checks if a define with a name exists
+    [[nodiscard]] bool has_define(std::string_view name) const;
+
+
     /// Returns a container of options filled with each option that has a flag.
     /// Each may or may not have an argument attached.
     [[nodiscard]] options flags() const;
@@ -184,8 +1195,8 @@ public:
 
     // ========== Iteration and indexing ==========
     /// Iterator impl
-    [[nodiscard]] const_iterator begin() const { return &(*m_opts.begin()); }
-    [[nodiscard]] const_iterator end() const { return &(*m_opts.end()); }
+    [[nodiscard]] const_iterator begin() const { return m_opts.data(); }
+    [[nodiscard]] const_iterator end() const { return m_opts.data() + m_opts.size(); }
 
     /// Checks if this container is empty.
     [[nodiscard]] bool empty() const { return m_opts.empty(); }
@@ -204,409 +1215,2042 @@ public:
 
 
 private:
-    explicit options(std::vector<option> opts) : m_opts(std::move(opts)) {}
+    friend class frozen_options;
+    template <size_t N>
+    friend class static_options;
+
+    options(std::vector<option> opts,
+            options_detail::shared_ref<options_detail::config_file> config,
+            options_detail::shared_ref<options_detail::string_arena> arena) :
+        m_opts(std::move(opts)), m_offsets(), m_grouped(), m_layer_ends(),
+        m_config(std::move(config)), m_arena(std::move(arena)),
+        m_fingerprint(), m_defines()
+    {
+        build_index();
+        refingerprint();
+    }
+
+    /// Tokenizes [first, last), appending to opts unless it is nullptr
+    /// @returns h extended with the fingerprint of each option
+    template <typename Iterator>
+    static uint64_t parse_tokens(Iterator first, Iterator last, uint64_t h,
+                                 std::vector<option> *opts);
+    void parse_env(const char *prefix);
+    void parse_config(const char *path);
+
+    /// Groups m_opts indices by flag
+    void build_index();
+
+    /// Recomputes m_fingerprint from m_opts, after editing
+    void refingerprint();
+
+    /// Leaves this container empty, after its options were moved out
+    void make_empty() noexcept;
+
+    /// @returns the define index, building it if this is the first lookup,
+    /// or nullptr if there are no defines
+    const options_detail::define_index *defines() const;
+
+    /// m_opts index of the first option with a flag, or -1 if none
+    [[nodiscard]] int first_index(char flag) const
+    {
+        unsigned char f = (unsigned char)flag;
+        return m_offsets[f] < m_offsets[f + 1] ? m_grouped[m_offsets[f]] : -1;
+    }
+
+    /// Every option with a flag, from every layer
+    [[nodiscard]] option_occurrences all_occurrences(char flag) const;
+
     std::vector<option> m_opts;
+
+    /// Options grouped by flag, in compressed sparse row layout: the m_opts
+    /// indices of the options with flag f are m_grouped[m_offsets[f]] up to
+    /// m_grouped[m_offsets[f + 1]], in argv order. Any occurrence of a flag,
+    /// and the number of them, is found in one step, however many layers
+    /// were read.
+    int m_offsets[UCHAR_MAX + 2];
+    std::vector<int> m_grouped;
+
+    /// End of the first layer in each flag's row: m_grouped[m_offsets[f]]
+    /// up to m_grouped[m_layer_ends[f]] share the first option's source
+    int m_layer_ends[UCHAR_MAX + 1];
+
+    /// Copies str into an arena no other container shares
+    const char *store(std::string_view str);
+
+    /// Keeps config file tokens alive for as long as any option refers to them
+    options_detail::shared_ref<options_detail::config_file> m_config;
+
+    /// Strings added by editing
+    options_detail::shared_ref<options_detail::string_arena> m_arena;
+
+    uint64_t m_fingerprint;
+
+    /// The define index, built on the first get_define. Replaced by
+    /// build_index, and null if there are no defines.
+    options_detail::shared_ref<options_detail::define_cache> m_defines;
+};
+
+/// A command line known at compile time, e.g. defaults baked into a binary,
+/// parsed during constant evaluation into a flag-indexed table. Tokens are
+/// paired exactly as options(argc, argv) pairs them. Lookups, and parse_arg
+/// for strings, integers and bool, are constexpr too:
+///
+///     static constexpr const char *tokens[] {"-j", "4", "-v"};
+///     constexpr static_options defaults(tokens);
+///     static_assert(defaults.parse_arg<int>('j').value() == 4);
+///
+/// The tokens are not copied, so they must outlive it; string literals do.
+template <size_t N>
+class static_options {
+public:
+    typedef const option *const_iterator;
+
+    /// @param argv N c-strings: an array, or a std::array, e.g.
+    /// static_options(std::array {"-j", "4"})
+    template <typename Tokens>
+    constexpr explicit static_options(const Tokens &argv);
+
+
+    /// @returns a runtime options container with the same options, for code
+    /// that takes one
+    [[nodiscard]] options to_options() const;
+
+
+    /// Checks if this container has an option with an indicated flag.
+    [[nodiscard]] constexpr bool has_flag(char flag) const { return m_first[(unsigned char)flag] >= 0; }
+
+
+    /// Finds the first option with a particular flag
+    /// @param flag the flag to check
+    /// @param opt [out] the option to receive
+    /// @returns true if one was found, false if there was none
+    constexpr bool get_option(char flag, option *opt) const;
+
+
+    /// Finds and converts the arg of the first option with a specified flag,
+    /// like options::parse_arg. A constant expression for every T whose
+    /// parse_traits<T>::parse is constexpr.
+    template <typename T>
+    [[nodiscard]] constexpr arg_result<T> parse_arg(char flag) const;
+
+    [[nodiscard]] constexpr const_iterator begin() const { return m_opts; }
+    [[nodiscard]] constexpr const_iterator end() const { return m_opts + m_size; }
+    [[nodiscard]] constexpr bool empty() const { return m_size == 0; }
+    [[nodiscard]] constexpr size_t size() const { return m_size; }
+    [[nodiscard]] constexpr const option &operator[](size_t index) const { return m_opts[index]; }
+
+private:
+    /// A flag and its arg make one option, so there are at most N
+    option m_opts[N ? N : 1];
+    size_t m_size;
+
+    /// m_opts index of the first option with each flag, or -1 if none
+    int m_first[UCHAR_MAX + 1];
+};
+
+/// N is the number of tokens
+template <size_t N>
+static_options(const char *const (&argv)[N]) -> static_options<N>;
+
+/// std::array, and other tuple-like arrays
+template <typename Tokens>
+static_options(const Tokens &argv) -> static_options<std::tuple_size<Tokens>::value>;
+
+/// A runtime table of flags bound to variables, for programs whose flags are
+/// not known at compile time. Register each flag once, then apply() walks the
+/// options a single time, sending each one straight to its binding through a
+/// flag-indexed table, and reports every conversion error together.
+class option_bindings {
+public:
+    /// A bound option whose arg could not be converted
+    struct error {
+        char flag;
+        int index;    ///< the option's argv index
+        arg_errc err; ///< no_argument, invalid or out_of_range
+    };
+
+    option_bindings();
+
+
+    /// Binds a flag's arg to a variable. Binding a flag again replaces it.
+    /// @param flag the flag to bind
+    /// @param dest variable receiving the first option's arg, converted with
+    /// parse_traits<T>. It must outlive every apply() call.
+    /// @param default_value written to dest by apply() if the flag is missing.
+    /// T is deduced from dest alone, so e.g. 7 can default a long.
+    template <typename T>
+    void bind(char flag, T *dest, typename std::common_type<T>::type default_value = T());
+
+
+    /// Binds a flag's presence to a bool: true if any option has the flag,
+    /// with or without an arg, false otherwise.
+    void bind_flag(char flag, bool *dest);
+
+
+    /// Resets every destination to its default, then walks opts once, writing
+    /// the first option of each bound flag to its destination.
+    /// @param opts the options to read
+    /// @param errors [out] optional, receives every option that failed to
+    /// convert; its destination keeps the default
+    /// @returns true if every bound option converted
+    bool apply(const options &opts, std::vector<error> *errors = nullptr) const;
+
+
+    /// @returns the number of bound flags
+    [[nodiscard]] size_t size() const { return m_bindings.size(); }
+
+private:
+    struct binding {
+        void *dest;
+
+        /// converts arg into dest, or returns why it couldn't; nullptr for
+        /// bind_flag, which needs no arg
+        arg_errc (*convert)(std::string_view arg, void *dest);
+
+        /// copies the default into dest
+        void (*reset)(void *dest, const void *default_value);
+        options_detail::any_value default_value;
+
+        /// dest is a const char *, which needs a NUL-terminated arg
+        bool c_string;
+    };
+
+    template <typename T>
+    static arg_errc convert(std::string_view arg, void *dest);
+
+    template <typename T>
+    static void reset(void *dest, const void *default_value);
+
+    void add(char flag, binding b);
+
+    std::vector<binding> m_bindings;
+
+    /// m_bindings index for each flag, or -1 if unbound
+    short m_table[UCHAR_MAX + 1];
+};
+
+/// Routes the subcommands of a multi-call program, e.g. "tool <sub> [opts]",
+/// to their handlers. The subcommand is argv[1]; it is resolved through a
+/// perfect hash table with one string comparison, and only the argv slice
+/// from the subcommand onward is parsed into options, so other subcommands'
+/// options are never tokenized. A subcommand may be another router, for
+/// nested subcommands like "tool remote add [opts]".
+class subcommand_router {
+public:
+    /// Runs a subcommand. opts[0] is the subcommand's name.
+    typedef int (*handler)(const options &opts);
+
+    subcommand_router();
+
+
+    /// Adds a subcommand. Adding a name again replaces it.
+    /// @param name subcommand name, which must outlive the router
+    /// @param fn called with the options following the name
+    void add(const char *name, handler fn);
+
+
+    /// Adds a nested router, which dispatches on the next argument
+    /// @param name subcommand name, which must outlive the router
+    /// @param child router for the subcommand's own subcommands, which must
+    /// outlive this one
+    void add(const char *name, subcommand_router *child);
+
+
+    /// Builds the perfect hash table. dispatch() calls this after any add(),
+    /// so it only needs calling to move the one-time cost to startup.
+    void build();
+
+
+    /// Runs the handler of the subcommand named by argv[1]
+    /// @param argc argument count
+    /// @param argv array of c-string args; argv[0] is the program name
+    /// @param result [out] the handler's return value
+    /// @returns true if a subcommand ran, false if argv[1] is missing or is
+    /// not a subcommand
+    bool dispatch(int argc, char *argv[], int *result);
+
+
+    /// @returns true if name is a subcommand of this router
+    [[nodiscard]] bool contains(std::string_view name) const;
+
+private:
+    struct entry {
+        std::string_view name;
+        handler fn;
+        subcommand_router *child;
+    };
+
+    void add(entry e);
+
+    /// Finds name's entry in the built table, or nullptr
+    [[nodiscard]] const entry *find(std::string_view name) const;
+
+    std::vector<entry> m_entries;
+
+    /// Hash and displace: a name's bucket picks a seed, and that seed's hash
+    /// picks the name's slot. Each slot is an m_entries index, or -1.
+    std::vector<uint32_t> m_seeds;
+    std::vector<int> m_slots;
+    bool m_built;
+};
+
+/// Immutable snapshot of an options container for sharing between threads.
+/// Every flag's lookup and typed conversion is computed once at construction,
+/// so reads are a table index plus a copy.
+///
+/// Thread safety: once constructed, any number of threads may call the const
+/// member functions concurrently without synchronization. Reads are wait-free,
+/// allocate nothing, and have no side effects: errors are returned through the
+/// optional err parameter rather than errno.
+class frozen_options {
+public:
+    /// Freezes a copy of opts. Its strings must outlive the snapshot.
+    explicit frozen_options(options opts);
+
+
+    /// The frozen container, e.g. for iteration
+    [[nodiscard]] const options &opts() const { return m_opts; }
+
+
+    /// Checks if the snapshot has an option with an indicated flag.
+    [[nodiscard]] bool has_flag(char flag) const;
+
+
+    /// Finds the first option with a particular flag
+    /// @param flag the flag to check
+    /// @param opt [out] the option to receive
+    /// @returns true if one was found, false if there was none
+    bool get_option(char flag, option *opt) const;
+
+
+    /// Finds the arg of the first option with a specified flag
+    /// @returns true if parameter was found, false if there was either a missing option,
+    /// or the option found did not have an arg.
+    bool get_arg(char flag, const char **param) const;
+    bool get_arg(char flag, std::string_view *param) const;
+
+
+    /// Gets the precomputed value of the first option with a specified flag,
+    /// with the same results as options::get_arg.
+    /// @param flag the flag to check
+    /// @param val [out] the value to get
+    /// @param err [out] optional, receives what options::get_arg would leave
+    /// in errno on failure, e.g. EINVAL or ERANGE, and 0 on success.
+    /// @returns true if parameter was found and parsed correctly
+    bool get_arg(char flag, long *val, int *err = nullptr) const;
+    bool get_arg(char flag, int *val, int *err = nullptr) const;
+    bool get_arg(char flag, bool *val, int *err = nullptr) const;
+    bool get_arg(char flag, long double *val, int *err = nullptr) const;
+    bool get_arg(char flag, double *val, int *err = nullptr) const;
+    bool get_arg(char flag, float *val, int *err = nullptr) const;
+
+
+    /// Finds a define by name, as options::get_define does. The index is
+    /// built when the snapshot is frozen, so lookups never write.
+    bool get_define(std::string_view name, std::string_view *value,
+                    define_policy policy = define_policy::last_wins) const;
+
+private:
+    /// Every conversion of one flag's first option
+    struct entry {
+        int index;
+        arg_result<long> l;
+        arg_result<int> i;
+        arg_result<bool> b;
+        arg_result<long double> ld;
+        arg_result<double> d;
+        arg_result<float> f;
+    };
+
+    template <typename T>
+    bool get(char flag, arg_result<T> entry::*member, T *val, int *err) const;
+
+    options m_opts;
+    std::vector<entry> m_entries;
+
+    /// m_entries index for each flag, or -1 if none
+    short m_lookup[UCHAR_MAX + 1];
 };
 
-inline void
-option::log(FILE *output) const
+// ========== Template definitions ==========
+
+template <size_t N>
+template <typename Tokens>
+constexpr
+static_options<N>::static_options(const Tokens &argv) :
+    m_opts(), m_size(), m_first()
+{
+    for (int &first : m_first)
+        first = -1;
+
+    for (size_t i = 0; i < N; ++i)
+    {
+        auto paired = options_detail::pair_token(std::begin(argv) + i, std::begin(argv) + N);
+        std::string_view flag_token;
+        if (paired.flag)
+            flag_token = argv[i];
+        const char *arg = paired.has_arg ? paired.arg : nullptr;
+        option o((int)i, paired.flag, arg, arg ? std::char_traits<char>::length(arg) : 0,
+                 option_source::argv, true, flag_token, paired.attached);
+        if (paired.consumed_next)
+            ++i;
+
+        int &first = m_first[(unsigned char)o.flag()];
+        if (first < 0)
+            first = (int)m_size;
+        m_opts[m_size++] = o;
+    }
+}
+
+
+template <size_t N>
+inline options
+static_options<N>::to_options() const
+{
+    return options(std::vector<option>(begin(), end()), {}, {});
+}
+
+
+template <size_t N>
+constexpr bool
+static_options<N>::get_option(char flag, option *opt) const
+{
+    assert(opt);
+
+    int i = m_first[(unsigned char)flag];
+    if (i < 0)
+        return false;
+
+    *opt = m_opts[i];
+    return true;
+}
+
+
+template <size_t N>
+template <typename T>
+constexpr arg_result<T>
+static_options<N>::parse_arg(char flag) const
+{
+    int i = m_first[(unsigned char)flag];
+    if (i < 0)
+        return arg_errc::missing_flag;
+    if (!m_opts[i].has_arg())
+        return arg_errc::no_argument;
+    return parse_traits<T>::parse(m_opts[i].arg_view());
+}
+
+
+template <typename Range, typename>
+inline
+options::options(const Range &tokens) :
+    m_opts(), m_offsets(), m_grouped(), m_layer_ends(), m_config(), m_arena(),
+    m_fingerprint(), m_defines()
+{
+    m_fingerprint = parse_tokens(std::begin(tokens), std::end(tokens),
+                                 options_detail::fingerprint_basis, &m_opts);
+    build_index();
+}
+
+
+template <typename Iterator>
+inline uint64_t
+options::parse_tokens(Iterator first, Iterator last, uint64_t h, std::vector<option> *opts)
+{
+    typedef decltype(options_detail::to_token(*first)) token_type;
+
+    // only c-string tokens are known to be followed by '\0'
+    constexpr bool terminated = std::is_same_v<token_type, const char *>;
+
+    // visit each token
+    for (int i = 0; first != last; ++i, ++first)
+    {
+        token_type token = options_detail::to_token(*first);
+        auto paired = options_detail::pair_token(first, last);
+        int ind = i;
+        if (paired.consumed_next)
+        {
+            ++first; // we consumed the next token, so skip it
+            ++i;
+        }
+
+        // commit option, measuring and fingerprinting its flag token and arg
+        // here and only here; an attached arg is the rest of the flag token
+        char flag = paired.flag;
+        const char *data = paired.has_arg ? options_detail::token_data(paired.arg) : nullptr;
+        h = options_detail::fingerprint_header(h, flag, option_source::argv, data);
+        size_t rest_length = flag ? options_detail::fingerprint_arg(&h, options_detail::after_flag(token)) : 0;
+        std::string_view flag_token;
+        if (flag)
+            flag_token = std::string_view(options_detail::token_data(token), rest_length + 2);
+
+        size_t length = 0;
+        if (paired.attached)
+            length = options_detail::fingerprint_arg(&h, std::string_view(data, rest_length));
+        else if (data)
+            length = options_detail::fingerprint_arg(&h, paired.arg);
+        if (opts)
+            opts->emplace_back(ind, flag, data, length, option_source::argv, terminated,
+                               flag_token, paired.attached);
+    }
+
+    return h;
+}
+
+
+template <typename T>
+inline arg_result<T>
+options::parse_arg(char flag) const
+{
+    int i = first_index(flag);
+    if (i < 0)
+        return arg_errc::missing_flag;
+    if (!m_opts[i].has_arg())
+        return arg_errc::no_argument;
+    if constexpr (std::is_same_v<T, const char *>)
+    {
+        if (!m_opts[i].is_terminated())
+            return arg_errc::invalid;
+    }
+    return parse_traits<T>::parse(m_opts[i].arg_view());
+}
+
+
+template <typename T>
+inline bool
+options::get_arg(char flag, T *val) const
+{
+    assert(val);
+    return options_detail::unwrap(parse_arg<T>(flag), val);
+}
+
+
+template <typename T>
+inline typed_arg_list<T>
+options::get_list(char flag, char delim) const
+{
+    return typed_arg_list<T>(get_list(flag, delim));
+}
+
+
+template <typename T>
+inline void
+option_bindings::bind(char flag, T *dest, typename std::common_type<T>::type default_value)
+{
+    assert(dest);
+    add(flag, binding {dest, &convert<T>, &reset<T>,
+                       options_detail::any_value(std::move(default_value)),
+                       std::is_same_v<T, const char *>});
+}
+
+
+template <typename T>
+inline arg_errc
+option_bindings::convert(std::string_view arg, void *dest)
+{
+    arg_result<T> result = parse_traits<T>::parse(arg);
+    if (result)
+        *static_cast<T *>(dest) = result.value();
+    return result.error();
+}
+
+
+template <typename T>
+inline void
+option_bindings::reset(void *dest, const void *default_value)
+{
+    *static_cast<T *>(dest) = *static_cast<const T *>(default_value);
+}
+
+
+template <typename T>
+inline bool
+frozen_options::get(char flag, arg_result<T> entry::*member, T *val, int *err) const
+{
+    assert(val);
+
+    int i = m_lookup[(unsigned char)flag];
+    if (i < 0)
+    {
+        if (err)
+            *err = 0;
+        return false;
+    }
+
+    const arg_result<T> &result = m_entries[i].*member;
+    if (err)
+    {
+        *err = result.error() == arg_errc::invalid ? EINVAL :
+               result.error() == arg_errc::out_of_range ? ERANGE : 0;
+    }
+    if (result)
+        *val = result.value();
+    return result.ok();
+}
+
+
+// ========== Definitions ==========
+// Header-only by default. Define OPTIONS_COMPILED to compile these once in a
+// library instead (see options.cpp), leaving only declarations and templates
+// in every translation unit that includes this header.
+
+#if !defined(OPTIONS_COMPILED) || defined(OPTIONS_IMPLEMENTATION)
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace options_detail {
+    /// parse_floating for each floating point type
+    template <typename T>
+    inline arg_result<T>
+    read_floating(std::string_view arg)
+    {
+        const char *last = arg.data() + arg.size();
+        const char *first = skip_number_prefix(arg.data(), last);
+
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+        T value;
+
+        // strtod reads "0x1.8p3"; from_chars only reads it without the
+        // sign and prefix
+        const char *digits = first != last && *first == '-' ? first + 1 : first;
+        if (last - digits > 2 && digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'X') &&
+            is_hex_float_start(digits[2]))
+        {
+            std::from_chars_result result = std::from_chars(digits + 2, last, value, std::chars_format::hex);
+            if (result.ec == std::errc::result_out_of_range)
+                return arg_errc::out_of_range;
+            if (result.ec == std::errc())
+                return digits != first ? -value : value;
+            // otherwise it's "0" followed by junk, as for strtod
+        }
+
+        std::from_chars_result result = std::from_chars(first, last, value);
+        if (result.ec == std::errc::result_out_of_range)
+            return arg_errc::out_of_range;
+        if (result.ec != std::errc())
+            return arg_errc::invalid;
+        return value;
+#else
+        // No floating point from_chars in this standard library: fall back
+        // to strto*, which needs a terminated string and reports via errno.
+        // Restore errno so callers still see no side effect.
+        std::string terminated(first, last);
+        char *end;
+        int saved_errno = errno;
+        errno = 0;
+        T value;
+        if constexpr (std::is_same_v<T, float>)
+            value = strtof(terminated.c_str(), &end);
+        else if constexpr (std::is_same_v<T, double>)
+            value = strtod(terminated.c_str(), &end);
+        else
+            value = strtold(terminated.c_str(), &end);
+        bool out_of_range = errno == ERANGE;
+        errno = saved_errno;
+
+        if (end == terminated.c_str())
+            return arg_errc::invalid;
+        if (out_of_range)
+            return arg_errc::out_of_range;
+        return value;
+#endif
+    }
+
+    template <>
+    OPTIONS_INLINE arg_result<float>
+    parse_floating<float>(std::string_view arg)
+    {
+        return read_floating<float>(arg);
+    }
+
+    template <>
+    OPTIONS_INLINE arg_result<double>
+    parse_floating<double>(std::string_view arg)
+    {
+        return read_floating<double>(arg);
+    }
+
+    template <>
+    OPTIONS_INLINE arg_result<long double>
+    parse_floating<long double>(std::string_view arg)
+    {
+        return read_floating<long double>(arg);
+    }
+
+    /// The reference count behind a shared_ref
+    class shared_storage {
+    public:
+        /// @returns true if more than one shared_ref refers to this
+        [[nodiscard]] bool is_shared() const { return m_refs.load(std::memory_order_acquire) > 1; }
+
+    protected:
+        shared_storage() : m_refs(1) { }
+        ~shared_storage() = default;
+
+        template <typename T>
+        friend void retain_storage(const T *storage) noexcept;
+        template <typename T>
+        friend void release_storage(const T *storage) noexcept;
+
+    private:
+        mutable std::atomic<size_t> m_refs;
+    };
+
+    template <typename T>
+    inline void
+    retain_storage(const T *storage) noexcept
+    {
+        storage->m_refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    template <typename T>
+    inline void
+    release_storage(const T *storage) noexcept
+    {
+        if (storage->m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            delete storage;
+    }
+
+    /// An open-addressing hash table of define names, see options::get_define
+    struct define_index {
+        struct slot {
+            uint64_t hash;
+            size_t name_size;
+
+            /// m_opts indices of the defines found for first_wins and
+            /// last_wins; first is -1 in an empty slot
+            int first;
+            int last;
+        };
+
+        /// a power of two in size, at most half full
+        std::vector<slot> slots;
+    };
+
+    /// An options container's define_index, built on first use by whichever
+    /// thread gets there first. Copies share it, and with it the index built
+    /// so far: the m_opts indices it holds are the same in every copy.
+    class define_cache : public shared_storage {
+    public:
+        define_cache() : m_index(nullptr) { }
+        ~define_cache() { delete m_index.load(std::memory_order_acquire); }
+
+        define_cache(const define_cache &) = delete;
+        define_cache &operator=(const define_cache &) = delete;
+
+        /// @returns the index, or nullptr if not built yet
+        [[nodiscard]] const define_index *get() const { return m_index.load(std::memory_order_acquire); }
+
+        /// Installs index, unless another thread installed one first, in
+        /// which case index is deleted
+        /// @returns the installed index
+        const define_index *install(const define_index *index) const
+        {
+            const define_index *expected = nullptr;
+            if (m_index.compare_exchange_strong(expected, index, std::memory_order_acq_rel,
+                                                std::memory_order_acquire))
+                return index;
+
+            delete index;
+            return expected;
+        }
+
+    private:
+        mutable std::atomic<const define_index *> m_index;
+    };
+
+    /// A config file's contents, privately mapped (copy-on-write) with one
+    /// trailing zero byte, so value tokens can be NUL-terminated in place
+    /// without copying them out of the mapping.
+    class config_file : public shared_storage {
+    public:
+        explicit config_file(const char *path);
+        ~config_file();
+
+        config_file(const config_file &) = delete;
+        config_file &operator=(const config_file &) = delete;
+
+        /// @returns false if the file could not be opened or read
+        [[nodiscard]] bool is_open() const { return m_data != nullptr; }
+
+        [[nodiscard]] char *data() const { return m_data; }
+        [[nodiscard]] size_t size() const { return m_size; }
+
+    private:
+        char *m_data;
+        size_t m_size;
+    };
+
+    /// Append-only storage for strings added by editing an options container.
+    /// Strings never move once added. Copies of a container share its arena,
+    /// so an edit to a shared arena starts a new one that keeps the old one
+    /// alive instead of writing to it.
+    class string_arena : public shared_storage {
+    public:
+        explicit string_arena(shared_ref<string_arena> parent) :
+            m_parent(std::move(parent)), m_blocks(), m_used(), m_capacity() { }
+
+        ~string_arena()
+        {
+            for (char *block : m_blocks)
+                delete[] block;
+        }
+
+        string_arena(const string_arena &) = delete;
+        string_arena &operator=(const string_arena &) = delete;
+
+        /// @returns a NUL-terminated copy of str, valid for the arena's lifetime
+        const char *add(std::string_view str);
+
+    private:
+        static constexpr size_t block_size = 256;
+
+        shared_ref<string_arena> m_parent;
+        std::vector<char *> m_blocks;
+
+        /// bytes used and available in the last block
+        size_t m_used;
+        size_t m_capacity;
+    };
+
+    OPTIONS_INLINE void retain(const config_file *storage) noexcept { retain_storage(storage); }
+    OPTIONS_INLINE void release(const config_file *storage) noexcept { release_storage(storage); }
+    OPTIONS_INLINE void retain(const string_arena *storage) noexcept { retain_storage(storage); }
+    OPTIONS_INLINE void release(const string_arena *storage) noexcept { release_storage(storage); }
+    OPTIONS_INLINE void retain(const define_cache *storage) noexcept { retain_storage(storage); }
+    OPTIONS_INLINE void release(const define_cache *storage) noexcept { release_storage(storage); }
+
+    /// @returns "-x" for flag x, from a static table, so emitted flags need
+    /// no allocation
+    OPTIONS_INLINE const char *
+    flag_token(char flag)
+    {
+        struct table {
+            char tokens[UCHAR_MAX + 1][3];
+            table()
+            {
+                for (int c = 0; c <= UCHAR_MAX; ++c)
+                {
+                    tokens[c][0] = '-';
+                    tokens[c][1] = (char)c;
+                    tokens[c][2] = '\0';
+                }
+            }
+        };
+
+        static const table t;
+        return t.tokens[(unsigned char)flag];
+    }
+
+    /// @returns a well-mixed hash of a name: FNV-1a from a basis perturbed
+    /// by seed, then the splitmix64 finalizer, since define_index and
+    /// subcommand_router probe by the low bits. Each seed gives an unrelated
+    /// hash.
+    OPTIONS_INLINE uint64_t
+    hash_name(std::string_view name, uint64_t seed = 0)
+    {
+        uint64_t h = fingerprint_arg(fingerprint_basis ^ (seed * 0x9E3779B97F4A7C15ULL), name);
+        h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+        return h ^ (h >> 31);
+    }
+
+}
+
+
+OPTIONS_INLINE
+options_detail::config_file::config_file(const char *path) :
+    m_data(), m_size()
+{
+    assert(path);
+
+#if defined(_WIN32)
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return;
+
+    if (fseek(file, 0, SEEK_END) == 0)
+    {
+        long size = ftell(file);
+        if (size >= 0 && fseek(file, 0, SEEK_SET) == 0)
+        {
+            m_data = static_cast<char *>(calloc((size_t)size + 1, 1));
+            if (m_data)
+            {
+                m_size = fread(m_data, 1, (size_t)size, file);
+            }
+        }
+    }
+    fclose(file);
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+    {
+        size_t size = (size_t)st.st_size;
+
+        // Reserve size + 1 zeroed bytes, then map the file over the front of
+        // them. The trailing zero terminates the last token even when the
+        // file fills its final page exactly.
+        void *base = mmap(nullptr, size + 1, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base != MAP_FAILED)
+        {
+            if (size == 0 ||
+                mmap(base, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_FIXED, fd, 0) != MAP_FAILED)
+            {
+                m_data = static_cast<char *>(base);
+                m_size = size;
+            }
+            else
+            {
+                munmap(base, size + 1);
+            }
+        }
+    }
+    close(fd);
+#endif
+}
+
+
+OPTIONS_INLINE const char *
+options_detail::string_arena::add(std::string_view str)
+{
+    size_t needed = str.size() + 1;
+    if (m_blocks.empty() || m_capacity - m_used < needed)
+    {
+        // reserve first, so that a failed push_back can't leak the block
+        size_t capacity = std::max(block_size, needed);
+        m_blocks.reserve(m_blocks.size() + 1);
+        m_blocks.push_back(new char[capacity]);
+        m_capacity = capacity;
+        m_used = 0;
+    }
+
+    char *copy = m_blocks.back() + m_used;
+    memcpy(copy, str.data(), str.size());
+    copy[str.size()] = '\0';
+    m_used += needed;
+    return copy;
+}
+
+
+OPTIONS_INLINE
+options_detail::config_file::~config_file()
+{
+    if (!m_data)
+        return;
+
+#if defined(_WIN32)
+    free(m_data);
+#else
+    munmap(m_data, m_size + 1);
+#endif
+}
+
+
+OPTIONS_INLINE void
+option::log(FILE *output) const
+{
+    assert(output);
+
+    switch (source())
+    {
+        case option_source::environment:
+            fprintf(output, "[env]");
+            break;
+        case option_source::config_file:
+            fprintf(output, "[config]");
+            break;
+        default:
+            fprintf(output, "[%i]", index());
+            break;
+    }
+    if (has_flag())
+        fprintf(output, " -%c", flag());
+    if (has_arg())
+        fprintf(output, " %.*s", (int)arg_size(), arg());
+    fprintf(output, "\n");
+}
+
+
+OPTIONS_INLINE
+options::options(int argc, char *argv[]) :
+    m_opts(), m_offsets(), m_grouped(), m_layer_ends(), m_config(), m_arena(),
+    m_fingerprint(), m_defines()
+{
+    m_fingerprint = parse_tokens(argv, argv + argc, options_detail::fingerprint_basis, &m_opts);
+    build_index();
+}
+
+
+OPTIONS_INLINE
+options::options(int argc, char *argv[], const char *env_prefix,
+                 const char *config_path) :
+    m_opts(), m_offsets(), m_grouped(), m_layer_ends(), m_config(), m_arena(),
+    m_fingerprint(), m_defines()
+{
+    m_fingerprint = parse_tokens(argv, argv + argc, options_detail::fingerprint_basis, &m_opts);
+    if (env_prefix)
+        parse_env(env_prefix);
+    if (config_path)
+        parse_config(config_path);
+    build_index();
+}
+
+
+OPTIONS_INLINE uint64_t
+options::fingerprint(int argc, char *argv[])
+{
+    return parse_tokens(argv, argv + argc, options_detail::fingerprint_basis, nullptr);
+}
+
+
+OPTIONS_INLINE void
+options::parse_env(const char *prefix)
+{
+    assert(prefix);
+
+    // "PREFIX_" followed by the flag, rewritten in place for each flag
+    std::string name(prefix);
+    name += "_?";
+
+    for (int c = 0; c <= UCHAR_MAX; ++c)
+    {
+        if (!options_detail::is_alpha((unsigned char)c))
+            continue;
+
+        name.back() = (char)c;
+        const char *value = getenv(name.c_str());
+        if (!value)
+            continue;
+
+        // getenv's storage changes with setenv/unsetenv, so keep a copy
+        size_t length = strlen(value);
+        m_opts.emplace_back(-1, (char)c, length ? store({value, length}) : nullptr, length,
+                            option_source::environment);
+        m_fingerprint = options_detail::fingerprint_option(m_fingerprint, m_opts.back());
+    }
+}
+
+
+OPTIONS_INLINE void
+options::parse_config(const char *path)
+{
+    options_detail::shared_ref<options_detail::config_file> file(new options_detail::config_file(path));
+    if (!file->is_open())
+        return;
+
+    char *data = file->data();
+    std::string_view text(data, file->size());
+
+    size_t line_start = 0;
+    while (line_start < text.size())
+    {
+        size_t line_end = text.find('\n', line_start);
+        if (line_end == std::string_view::npos)
+            line_end = text.size();
+
+        std::string_view line = text.substr(line_start, line_end - line_start);
+        size_t offset = line_start;
+        line_start = line_end + 1;
+
+        // trim surrounding whitespace (including '\r' from CRLF files)
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string_view::npos || line[first] == '#')
+            continue;
+        size_t last = line.find_last_not_of(" \t\r");
+        line = line.substr(first, last - first + 1);
+        offset += first;
+
+        // single character key, optionally followed by "= value"
+        char flag = line[0];
+        if (!options_detail::is_alpha((unsigned char)flag))
+            continue;
+
+        std::string_view rest = line.substr(1);
+        size_t eq = rest.find_first_not_of(" \t");
+        if (eq != std::string_view::npos && rest[eq] != '=')
+            continue;
+
+        const char *arg = nullptr;
+        size_t arg_len = 0;
+        if (eq != std::string_view::npos)
+        {
+            std::string_view value = rest.substr(eq + 1);
+            size_t value_first = value.find_first_not_of(" \t");
+            if (value_first != std::string_view::npos)
+            {
+                value = value.substr(value_first);
+
+                // terminate in place: the byte after the value is trailing
+                // whitespace, a newline, or the mapping's spare zero byte
+                char *value_begin = data + offset + 1 + eq + 1 + value_first;
+                value_begin[value.size()] = '\0';
+                arg = value_begin;
+                arg_len = value.size();
+            }
+        }
+
+        m_opts.emplace_back(-1, flag, arg, arg_len, option_source::config_file);
+        m_fingerprint = options_detail::fingerprint_option(m_fingerprint, m_opts.back());
+    }
+
+    m_config = std::move(file);
+}
+
+
+OPTIONS_INLINE void
+options::build_index()
+{
+    // count each flag, then turn counts into offsets
+    for (int &offset : m_offsets)
+        offset = 0;
+    for (const option &o : m_opts)
+        ++m_offsets[(unsigned char)o.flag() + 1];
+    for (int f = 1; f <= UCHAR_MAX + 1; ++f)
+        m_offsets[f] += m_offsets[f - 1];
+
+    // place each option's index in its flag's row, keeping argv order
+    int next[UCHAR_MAX + 1];
+    std::copy(m_offsets, m_offsets + UCHAR_MAX + 1, next);
+    m_grouped.resize(m_opts.size());
+    for (int i = 0; i < (int)m_opts.size(); ++i)
+    {
+        m_grouped[next[(unsigned char)m_opts[i].flag()]++] = i;
+    }
+
+    // find where each row's first layer ends
+    for (int f = 0; f <= UCHAR_MAX; ++f)
+    {
+        int end = m_offsets[f];
+        if (end < m_offsets[f + 1])
+        {
+            option_source first = m_opts[m_grouped[end]].source();
+            while (end < m_offsets[f + 1] && m_opts[m_grouped[end]].source() == first)
+                ++end;
+        }
+        m_layer_ends[f] = end;
+    }
+
+    unsigned char d = (unsigned char)define_flag;
+    if (m_offsets[d] < m_offsets[d + 1])
+        m_defines = options_detail::shared_ref<options_detail::define_cache>(new options_detail::define_cache());
+    else
+        m_defines = options_detail::shared_ref<options_detail::define_cache>();
+}
+
+
+OPTIONS_INLINE void
+options::refingerprint()
+{
+    uint64_t h = options_detail::fingerprint_basis;
+    for (const option &o : m_opts)
+        h = options_detail::fingerprint_option(h, o);
+
+    m_fingerprint = h;
+}
+
+
+OPTIONS_INLINE
+options::options(options &&other) noexcept :
+    m_opts(std::move(other.m_opts)), m_offsets(), m_grouped(std::move(other.m_grouped)),
+    m_layer_ends(),
+    m_config(std::move(other.m_config)), m_arena(std::move(other.m_arena)),
+    m_fingerprint(other.m_fingerprint), m_defines(std::move(other.m_defines))
+{
+    std::copy(other.m_offsets, other.m_offsets + UCHAR_MAX + 2, m_offsets);
+    std::copy(other.m_layer_ends, other.m_layer_ends + UCHAR_MAX + 1, m_layer_ends);
+    other.make_empty();
+}
+
+
+OPTIONS_INLINE options &
+options::operator=(options &&other) noexcept
+{
+    if (this != &other)
+    {
+        m_opts = std::move(other.m_opts);
+        std::copy(other.m_offsets, other.m_offsets + UCHAR_MAX + 2, m_offsets);
+        m_grouped = std::move(other.m_grouped);
+        std::copy(other.m_layer_ends, other.m_layer_ends + UCHAR_MAX + 1, m_layer_ends);
+        m_config = std::move(other.m_config);
+        m_arena = std::move(other.m_arena);
+        m_fingerprint = other.m_fingerprint;
+        m_defines = std::move(other.m_defines);
+        other.make_empty();
+    }
+
+    return *this;
+}
+
+
+OPTIONS_INLINE void
+options::make_empty() noexcept
+{
+    // the flag table must not point into the moved-out options
+    m_opts.clear();
+    m_grouped.clear();
+    for (int &offset : m_offsets)
+        offset = 0;
+    for (int &end : m_layer_ends)
+        end = 0;
+    m_fingerprint = options_detail::fingerprint_basis;
+    m_defines = options_detail::shared_ref<options_detail::define_cache>();
+}
+
+
+OPTIONS_INLINE void
+options::swap(options &other)
+{
+    other.m_opts.swap(m_opts);
+    std::swap(other.m_offsets, m_offsets);
+    other.m_grouped.swap(m_grouped);
+    std::swap(other.m_layer_ends, m_layer_ends);
+    other.m_config.swap(m_config);
+    other.m_arena.swap(m_arena);
+    std::swap(other.m_fingerprint, m_fingerprint);
+    other.m_defines.swap(m_defines);
+}
+
+
+OPTIONS_INLINE size_t
+options::remove(char flag)
+{
+    size_t before = m_opts.size();
+    m_opts.erase(std::remove_if(m_opts.begin(), m_opts.end(),
+        [flag](const option &o) { return o.flag() == flag; }), m_opts.end());
+
+    size_t removed = before - m_opts.size();
+    if (removed)
+    {
+        build_index();
+        refingerprint();
+    }
+    return removed;
+}
+
+
+OPTIONS_INLINE void
+options::set_arg(char flag, std::string_view arg)
+{
+    const char *copy = store(arg);
+
+    int first = first_index(flag);
+    if (first < 0)
+    {
+        m_opts.emplace_back(-1, flag, copy, arg.size());
+    }
+    else
+    {
+        // keep the flag's token, terminated like the new arg, unless the
+        // old arg was part of it
+        const option &o = m_opts[first];
+        std::string_view token = o.has_attached_arg() ? std::string_view() : o.flag_token();
+        if (!token.empty() && !o.is_terminated())
+            token = std::string_view(store(token), token.size());
+        m_opts[first] = option(o.index(), flag, copy, arg.size(), o.source(), true, token);
+
+        // drop the rest, keeping the first
+        size_t kept = 0;
+        for (size_t i = 0; i < m_opts.size(); ++i)
+        {
+            if ((int)i == first || m_opts[i].flag() != flag)
+                m_opts[kept++] = m_opts[i];
+        }
+        m_opts.resize(kept);
+    }
+
+    build_index();
+    refingerprint();
+}
+
+
+OPTIONS_INLINE void
+options::insert(size_t pos, char flag, std::string_view arg)
+{
+    const char *copy = store(arg);
+    pos = std::min(pos, m_opts.size());
+    m_opts.insert(m_opts.begin() + (std::ptrdiff_t)pos, option(-1, flag, copy, arg.size()));
+    build_index();
+    refingerprint();
+}
+
+
+OPTIONS_INLINE void
+options::insert(size_t pos, char flag)
+{
+    assert(flag && "a flag-only option needs a flag");
+    pos = std::min(pos, m_opts.size());
+    m_opts.insert(m_opts.begin() + (std::ptrdiff_t)pos, option(-1, flag, nullptr, 0));
+    build_index();
+    refingerprint();
+}
+
+
+OPTIONS_INLINE bool
+options::to_argv(argv_array *argv) const
+{
+    assert(argv);
+
+    // The child pairs the tokens as parse_tokens does. Parsed options pair
+    // the same way again, but edited ones may not.
+    size_t count = 0;
+    bool flag_open = false; // the last token was a flag without an arg
+    for (const option &o : m_opts)
+    {
+        bool separate_arg = o.has_arg() && !o.has_attached_arg();
+        if (o.has_flag() && !options_detail::is_alpha((unsigned char)o.flag()))
+            return false;
+        if (separate_arg && (options_detail::is_flag_token(o.arg_view()) || (flag_open && !o.has_flag())))
+            return false;
+
+        flag_open = o.is_flag_only();
+        count += (o.has_flag() ? 1 : 0) + (separate_arg ? 1 : 0);
+    }
+
+    argv_array result;
+    result.m_argv.resize(count + 1);
+    result.m_config = m_config;
+    result.m_arena = m_arena;
+
+    // copies of unterminated tokens, in an arena that keeps ours alive
+    options_detail::shared_ref<options_detail::string_arena> copies;
+    auto emit = [&](std::string_view token, bool terminated)
+    {
+        if (terminated)
+            return const_cast<char *>(token.data());
+        if (!copies)
+            copies = options_detail::shared_ref<options_detail::string_arena>(new options_detail::string_arena(m_arena));
+        return const_cast<char *>(copies->add(token));
+    };
+
+    char **out = result.m_argv.data();
+    for (const option &o : m_opts)
+    {
+        if (o.has_flag() && o.flag_token().empty())
+            *out++ = const_cast<char *>(options_detail::flag_token(o.flag()));
+        else if (o.has_flag())
+            *out++ = emit(o.flag_token(), o.is_terminated());
+        if (o.has_arg() && !o.has_attached_arg())
+            *out++ = emit(o.arg_view(), o.is_terminated());
+    }
+    *out = nullptr;
+
+    if (copies)
+        result.m_arena = std::move(copies);
+
+    result.m_argc = (int)count;
+    *argv = std::move(result);
+    return true;
+}
+
+
+OPTIONS_INLINE const char *
+options::store(std::string_view str)
+{
+    if (!m_arena || m_arena->is_shared())
+        m_arena = options_detail::shared_ref<options_detail::string_arena>(new options_detail::string_arena(std::move(m_arena)));
+    return m_arena->add(str);
+}
+
+
+OPTIONS_INLINE void
+options::log(FILE *output) const
+{
+    assert(output);
+
+    if (empty())
+    {
+        fprintf(output, "No options available.\n");
+        return;
+    }
+    
+    for (const option &o : m_opts)
+    {
+        o.log(output);
+    }
+}
+
+
+OPTIONS_INLINE bool
+options::get_option(char flag, option *opt) const
+{
+    assert(opt);
+
+    int i = first_index(flag);
+    if (i < 0)
+        return false;
+
+    *opt = m_opts[i];
+    return true;
+}
+
+
+OPTIONS_INLINE bool
+options::get_option(char flag, size_t n, option *opt) const
+{
+    assert(opt);
+
+    if (n >= count(flag))
+        return false;
+
+    *opt = m_opts[m_grouped[m_offsets[(unsigned char)flag] + n]];
+    return true;
+}
+
+
+OPTIONS_INLINE bool
+options::get_last_option(char flag, option *opt) const
+{
+    assert(opt);
+
+    unsigned char f = (unsigned char)flag;
+    if (m_offsets[f] == m_offsets[f + 1])
+        return false;
+
+    *opt = m_opts[m_grouped[m_layer_ends[f] - 1]];
+    return true;
+}
+
+
+OPTIONS_INLINE size_t
+options::count(char flag) const
+{
+    unsigned char f = (unsigned char)flag;
+    return (size_t)(m_layer_ends[f] - m_offsets[f]);
+}
+
+
+OPTIONS_INLINE option_occurrences
+options::occurrences(char flag) const
+{
+    unsigned char f = (unsigned char)flag;
+    const int *grouped = m_grouped.data();
+    return option_occurrences(m_opts.data(), grouped + m_offsets[f], grouped + m_layer_ends[f]);
+}
+
+
+OPTIONS_INLINE option_occurrences
+options::all_occurrences(char flag) const
+{
+    unsigned char f = (unsigned char)flag;
+    const int *grouped = m_grouped.data();
+    return option_occurrences(m_opts.data(), grouped + m_offsets[f], grouped + m_offsets[f + 1]);
+}
+
+
+OPTIONS_INLINE bool
+options::get_options(char flag, options *opts) const
+{
+    assert(opts);
+
+    std::vector<option> collection;
+    option_occurrences all = all_occurrences(flag);
+    collection.reserve(all.size());
+    for (const option &o : all)
+    {
+        collection.push_back(o);
+    }
+
+
+    if (collection.empty())
+    {
+        return false;
+    }
+    else
+    {
+        options new_opts(std::move(collection), m_config, m_arena);
+        opts->swap(new_opts);
+        return true;
+    }
+
+}
+
+
+OPTIONS_INLINE arg_list
+options::get_list(char flag, char delim) const
+{
+    int i = first_index(flag);
+    if (i < 0 || !m_opts[i].has_arg())
+        return arg_list();
+    return arg_list(m_opts[i].arg_view(), delim);
+}
+
+
+OPTIONS_INLINE bool
+options::get_arg(char flag, const char **param) const
+{
+    return get_arg<const char *>(flag, param);
+}
+
+
+OPTIONS_INLINE bool
+options::get_arg(char flag, std::string_view *param) const
+{
+    return get_arg<std::string_view>(flag, param);
+}
+
+
+OPTIONS_INLINE bool
+options::get_arg(char flag, long double *val) const
+{
+    return get_arg<long double>(flag, val);
+}
+
+
+OPTIONS_INLINE bool
+options::get_arg(char flag, double *val) const
+{
+    return get_arg<double>(flag, val);
+}
+
+
+OPTIONS_INLINE bool
+options::get_arg(char flag, float *val) const
+{
+    return get_arg<float>(flag, val);
+}
+
+
+OPTIONS_INLINE bool
+options::get_arg(char flag, long *val) const
+{
+    return get_arg<long>(flag, val);
+}
+
+
+OPTIONS_INLINE bool
+options::get_arg(char flag, int *val) const
+{
+    return get_arg<int>(flag, val);
+}
+
+
+OPTIONS_INLINE bool
+options::get_arg(char flag, bool *val) const
 {
-    assert(output);
+    return get_arg<bool>(flag, val);
+}
 
-    fprintf(output, "[%i]", index());
-    if (has_flag())
-        fprintf(output, " -%c", flag());
-    if (has_arg())
-        fprintf(output, " %s", arg());
-    fprintf(output, "\n");
+
+OPTIONS_INLINE bool
+options::has_flag(char flag) const
+{
+    return first_index(flag) >= 0;
 }
 
-inline
-options::options(int argc, char *argv[]) : m_opts()
+
+OPTIONS_INLINE const options_detail::define_index *
+options::defines() const
 {
-    // visit each argument
-    for (int i = 0; i < argc; ++i)
+    if (!m_defines)
+        return nullptr;
+    const options_detail::define_index *built = m_defines->get();
+    if (built)
+        return built;
+
+    options_detail::define_index index;
+    const size_t define_count = all_occurrences(define_flag).size();
+    size_t slot_count = 2;
+    while (slot_count < define_count * 2)
+        slot_count *= 2;
+    index.slots.assign(slot_count, options_detail::define_index::slot {0, 0, -1, -1});
+
+    const size_t mask = index.slots.size() - 1;
+    for (const option &o : all_occurrences(define_flag))
     {
-        char flag = '\0';
-        char *arg = nullptr; // ensure it's never nullptr for str length checks
-        int ind = -1;
-
-        size_t arg_len = (argv[i] == nullptr || argv[i][0] == '\0') ?
-                         0 : strlen(argv[i]);
-        
-        if (arg_len >= 2 && argv[i][0] == '-' &&
-            isalpha(argv[i][1]))                    // is flag
+        std::string_view arg = o.arg_view();
+        std::string_view name = arg.substr(0, arg.find('='));
+        if (name.empty())
+            continue;
+
+        int i = (int)(&o - m_opts.data());
+        uint64_t h = options_detail::hash_name(name);
+        for (size_t s = h & mask;; s = (s + 1) & mask)
         {
-            size_t next_arg_len =
-                    (argv[i + 1] == nullptr || argv[i + 1][0] == '\0') ?
-                    0 : strlen(argv[i + 1]);
-
-            if (i < argc - 1 && !(next_arg_len >= 2 && argv[i + 1][0] == '-' &&
-                isalpha(argv[i + 1][1])))           // flag paired with arg
+            options_detail::define_index::slot &slot = index.slots[s];
+            if (slot.first < 0)
             {
-                arg = argv[i + 1];
-                ind = i;
-                flag = argv[i][1];
-                ++i; // we consumed the next arg, so increase counter by one
+                slot = options_detail::define_index::slot {h, name.size(), i, i};
+                break;
             }
-            else                                       // flag has no arg
+
+            if (slot.hash == h && slot.name_size == name.size() &&
+                m_opts[slot.first].arg_view().substr(0, name.size()) == name)
             {
-                ind = i;
-                flag = argv[i][1];
+                // later layers never override an earlier one
+                if (o.source() == m_opts[slot.first].source())
+                    slot.last = i;
+                break;
             }
         }
-        else                                           // arg has no flag
+    }
+
+    return m_defines->install(new options_detail::define_index(std::move(index)));
+}
+
+
+OPTIONS_INLINE bool
+options::get_define(std::string_view name, std::string_view *value, define_policy policy) const
+{
+    assert(value);
+
+    const options_detail::define_index *index = defines();
+    if (!index)
+        return false;
+
+    const size_t mask = index->slots.size() - 1;
+    uint64_t h = options_detail::hash_name(name);
+    for (size_t s = h & mask;; s = (s + 1) & mask)
+    {
+        const options_detail::define_index::slot &slot = index->slots[s];
+        if (slot.first < 0)
+            return false;
+
+        if (slot.hash == h && slot.name_size == name.size() &&
+            m_opts[slot.first].arg_view().substr(0, name.size()) == name)
         {
-            arg = argv[i];
-            ind = i;
+            int i = policy == define_policy::first_wins ? slot.first : slot.last;
+            std::string_view arg = m_opts[i].arg_view();
+            *value = arg.substr(std::min(arg.size(), name.size() + 1));
+            return true;
         }
-        
-        // commit option
-        m_opts.emplace_back(ind, flag, arg);
     }
 }
 
 
-inline void
-options::swap(options &other)
+OPTIONS_INLINE bool
+options::has_define(std::string_view name) const
 {
-    other.m_opts.swap(m_opts);
+    std::string_view value;
+    return get_define(name, &value);
 }
 
 
-inline void
-options::log(FILE *output) const
+OPTIONS_INLINE options
+options::flags() const
 {
-    assert(output);
-
-    if (empty())
-    {
-        fprintf(output, "No options available.\n");
-        return;
-    }
-    
+    std::vector<option> ret;
     for (const option &o : m_opts)
     {
-        o.log(output);
+        if (o.has_flag())
+            ret.emplace_back(o);
     }
+    return options(std::move(ret), m_config, m_arena);
 }
 
 
-inline bool
-options::get_option(char flag, option *opt) const
+OPTIONS_INLINE options
+options::args() const
 {
-    assert(opt);
-
+    std::vector<option> ret;
     for (const option &o : m_opts)
     {
-        if (o.flag() == flag)
-        {
-            *opt = o;
-            return true;
-        }
+        if (o.is_arg_only())
+            ret.emplace_back(o);
     }
     
-    return false;
+    return options(std::move(ret), m_config, m_arena);
 }
 
 
-inline bool
-options::get_options(char flag, options *opts) const
+OPTIONS_INLINE
+option_bindings::option_bindings() : m_bindings(), m_table()
 {
-    assert(opts);
+    for (short &i : m_table)
+        i = -1;
+}
 
-    std::vector<option> collection;
-    for (const option &o : m_opts)
-    {
-        if (o.flag() == flag)
-        {
-            collection.push_back(o);
-        }
-    }
 
+OPTIONS_INLINE void
+option_bindings::bind_flag(char flag, bool *dest)
+{
+    assert(dest);
+    add(flag, binding {dest, nullptr, &reset<bool>, options_detail::any_value(false), false});
+}
 
-    if (collection.empty())
+
+OPTIONS_INLINE void
+option_bindings::add(char flag, binding b)
+{
+    short &i = m_table[(unsigned char)flag];
+    if (i >= 0)
     {
-        return false;
+        m_bindings[i] = std::move(b);
     }
     else
     {
-        options new_opts(std::move(collection));
-        opts->swap(new_opts);
-        return true;
+        assert(m_bindings.size() < SHRT_MAX);
+        i = (short)m_bindings.size();
+        m_bindings.push_back(std::move(b));
     }
-
 }
 
 
-inline bool
-options::get_arg(char flag, const char **param) const
+OPTIONS_INLINE bool
+option_bindings::apply(const options &opts, std::vector<error> *errors) const
 {
-    assert(param);
-
-    option opt;
-    if (get_option(flag, &opt) && opt.has_arg())
-    {
-        *param = opt.arg();
-        return true;
-    }
-
-    return false;
-}
+    for (const binding &b : m_bindings)
+        b.reset(b.dest, b.default_value.get());
 
-inline bool options::get_arg(char flag, long double *val) const
-{
-    assert(val);
+    // only the first option with each flag is applied
+    bool seen[UCHAR_MAX + 1] = {};
+    bool ok = true;
 
-    const char *param;
-    if (get_arg(flag, &param))
+    for (const option &o : opts)
     {
-        if (!param)
-            return false;
-
-        errno = 0;
-        try {
-            long double temp = std::stold(param, nullptr);
-            *val = temp;
-            return true;
+        unsigned char flag = (unsigned char)o.flag();
+        int i = m_table[flag];
+        if (i < 0 || seen[flag])
+            continue;
+        seen[flag] = true;
+
+        const binding &b = m_bindings[i];
+        arg_errc err;
+        if (!b.convert)
+        {
+            *static_cast<bool *>(b.dest) = true;
+            err = arg_errc::ok;
         }
-        catch(const std::invalid_argument &e)
+        else if (!o.has_arg())
         {
-            errno = EINVAL;
+            err = arg_errc::no_argument;
         }
-        catch(const std::out_of_range &e)
+        else if (b.c_string && !o.is_terminated())
         {
-            errno = ERANGE;
+            err = arg_errc::invalid;
+        }
+        else
+        {
+            err = b.convert(o.arg_view(), b.dest);
         }
 
-        // For some reason, std::stold (tested in Mac clang) sets errno to ENOENT after the catch block
-        // when an invalid arg exception is thrown.
-        // We'll set it here manually to match expected errno behavior for this function.
-        if (errno == ENOENT)
+        if (err != arg_errc::ok)
         {
-            errno = EINVAL;
+            ok = false;
+            if (errors)
+                errors->push_back(error {o.flag(), o.index(), err});
         }
     }
 
-    return false;
+    return ok;
 }
 
-inline bool options::get_arg(char flag, double *val) const
+
+OPTIONS_INLINE
+subcommand_router::subcommand_router() :
+    m_entries(), m_seeds(), m_slots(), m_built(false)
+{ }
+
+
+OPTIONS_INLINE void
+subcommand_router::add(const char *name, handler fn)
 {
-    assert(val);
+    assert(name && fn);
+    add(entry {name, fn, nullptr});
+}
 
-    const char *param;
-    if (get_arg(flag, &param))
-    {
-        if (!param)
-            return false;
 
-        errno = 0;
-        try {
-            double temp = std::stod(param, nullptr);
-            *val = temp;
-            return true;
-        }
-        catch(const std::invalid_argument &e)
-        {
-            errno = EINVAL;
-        }
-        catch(const std::out_of_range &e)
-        {
-            errno = ERANGE;
-        }
+OPTIONS_INLINE void
+subcommand_router::add(const char *name, subcommand_router *child)
+{
+    assert(name && child && child != this);
+    add(entry {name, nullptr, child});
+}
 
-        // For some reason, std::stod (tested in Mac clang) sets errno to ENOENT after the catch block
-        // when an invalid arg exception is thrown.
-        // We'll set it here manually to match expected errno behavior for this function.
-        if (errno == ENOENT)
+
+OPTIONS_INLINE void
+subcommand_router::add(entry e)
+{
+    m_built = false;
+    for (entry &existing : m_entries)
+    {
+        if (existing.name == e.name)
         {
-            errno = EINVAL;
+            existing = e;
+            return;
         }
     }
 
-    return false;
+    m_entries.push_back(e);
 }
 
-inline bool options::get_arg(char flag, float *val) const
+
+OPTIONS_INLINE void
+subcommand_router::build()
 {
-    assert(val);
+    const size_t n = m_entries.size();
+    size_t slot_count = 1;
+    while (slot_count < n * 2)
+        slot_count *= 2;
+    const size_t bucket_count = n / 4 + 1;
 
-    const char *param;
-    if (get_arg(flag, &param))
+    for (;; slot_count *= 2)
     {
-        if (!param)
-            return false;
-
-        errno = 0;
-        try {
-            float temp = std::stof(param, nullptr);
-            *val = temp;
-            return true;
-        }
-        catch(const std::invalid_argument &e)
-        {
-            errno = EINVAL;
-        }
-        catch(const std::out_of_range &e)
+        // group names into buckets with seed 0, then place the fullest
+        // buckets first, while the table is emptiest
+        std::vector<std::vector<int>> buckets(bucket_count);
+        for (int i = 0; i < (int)n; ++i)
+            buckets[options_detail::hash_name(m_entries[i].name) % bucket_count].push_back(i);
+
+        std::vector<size_t> order(bucket_count);
+        for (size_t b = 0; b < bucket_count; ++b)
+            order[b] = b;
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return buckets[a].size() > buckets[b].size();
+        });
+
+        m_seeds.assign(bucket_count, 0);
+        m_slots.assign(slot_count, -1);
+
+        bool placed_all = true;
+        for (size_t b : order)
         {
-            errno = ERANGE;
-        }
+            const std::vector<int> &bucket = buckets[b];
+            if (bucket.empty())
+                break;
+
+            // find a seed that sends every name in the bucket to a free slot
+            bool placed = false;
+            std::vector<size_t> taken;
+            for (uint32_t seed = 1; seed < 4096 && !placed; ++seed)
+            {
+                taken.clear();
+                placed = true;
+                for (int i : bucket)
+                {
+                    size_t slot = options_detail::hash_name(m_entries[i].name, seed) & (slot_count - 1);
+                    if (m_slots[slot] >= 0 ||
+                        std::find(taken.begin(), taken.end(), slot) != taken.end())
+                    {
+                        placed = false;
+                        break;
+                    }
+                    taken.push_back(slot);
+                }
+
+                if (placed)
+                {
+                    m_seeds[b] = seed;
+                    for (size_t k = 0; k < bucket.size(); ++k)
+                        m_slots[taken[k]] = bucket[k];
+                }
+            }
 
-        // For some reason, std::stold and std::stod (tested on Mac clang) sets errno to ENOENT after the catch block
-        // when an invalid arg exception is thrown.
-        // We'll set it here manually, just in case, to match expected errno behavior for this function.
-        if (errno == ENOENT)
-        {
-            errno = EINVAL;
+            if (!placed)
+            {
+                placed_all = false;
+                break;
+            }
         }
+
+        if (placed_all)
+            break;
+        // no seed fit: retry with a sparser table
     }
 
-    return false;
+    m_built = true;
 }
 
-inline bool
-options::get_arg(char flag, long *val) const
+
+OPTIONS_INLINE const subcommand_router::entry *
+subcommand_router::find(std::string_view name) const
 {
-    assert(val);
+    assert(m_built);
+    if (m_entries.empty())
+        return nullptr;
+
+    uint32_t seed = m_seeds[options_detail::hash_name(name) % m_seeds.size()];
+    int i = m_slots[options_detail::hash_name(name, seed) & (m_slots.size() - 1)];
+    if (i < 0 || m_entries[i].name != name)
+        return nullptr;
+    return &m_entries[i];
+}
 
-    const char *param;
-    if (get_arg(flag, &param))
-    {
-        if (!param)
-            return false;
 
-        errno = 0;
-        long temp = strtol(param, nullptr, 10);
-        if (errno != EINVAL && errno != ERANGE)
+OPTIONS_INLINE bool
+subcommand_router::contains(std::string_view name) const
+{
+    if (!m_built)
+    {
+        for (const entry &e : m_entries)
         {
-            *val = temp;
-            return true;
+            if (e.name == name)
+                return true;
         }
+        return false;
     }
 
-    return false;
+    return find(name) != nullptr;
 }
 
 
-inline bool
-options::get_arg(char flag, int *val) const
+OPTIONS_INLINE bool
+subcommand_router::dispatch(int argc, char *argv[], int *result)
 {
-    assert(val);
+    assert(result);
+
+    if (argc < 2 || !argv[1])
+        return false;
+    if (!m_built)
+        build();
+
+    const entry *e = find(argv[1]);
+    if (!e)
+        return false;
+
+    // the subcommand becomes argv[0] of its own slice
+    if (e->child)
+        return e->child->dispatch(argc - 1, argv + 1, result);
+
+    *result = e->fn(options(argc - 1, argv + 1));
+    return true;
+}
 
-    long temp;
-    if (get_arg(flag, &temp))
+
+OPTIONS_INLINE
+frozen_options::frozen_options(options opts) :
+    m_opts(std::move(opts)), m_entries(), m_lookup()
+{
+    for (int c = 0; c <= UCHAR_MAX; ++c)
     {
-        if (temp <= INT_MAX && temp >= INT_MIN)
-        {
-            *val = (int)temp;
-            return true;
-        }
-        else
+        char flag = (char)c;
+        if (m_opts.first_index(flag) < 0)
         {
-            // Might want to return an error code instead...
-            errno = ERANGE;
+            m_lookup[c] = -1;
+            continue;
         }
+
+        m_lookup[c] = (short)m_entries.size();
+        m_entries.push_back(entry {
+            m_opts.first_index(flag),
+            m_opts.parse_arg<long>(flag),
+            m_opts.parse_arg<int>(flag),
+            m_opts.parse_arg<bool>(flag),
+            m_opts.parse_arg<long double>(flag),
+            m_opts.parse_arg<double>(flag),
+            m_opts.parse_arg<float>(flag),
+        });
     }
 
-    return false;
+    m_opts.defines();
 }
 
 
-inline bool
-options::get_arg(char flag, bool *val) const
+OPTIONS_INLINE bool
+frozen_options::get_define(std::string_view name, std::string_view *value,
+                           define_policy policy) const
 {
-    assert(val);
+    return m_opts.get_define(name, value, policy);
+}
 
-    long temp;
-    const char *str = nullptr;
 
-    errno = 0;
-    if (get_arg(flag, &temp))
-    {
-        if (temp == 0 || temp == 1)
-        {
-            *val = temp;
-            return true;
-        }
-        errno = ERANGE;
+OPTIONS_INLINE bool
+frozen_options::has_flag(char flag) const
+{
+    return m_lookup[(unsigned char)flag] >= 0;
+}
+
+
+OPTIONS_INLINE bool
+frozen_options::get_option(char flag, option *opt) const
+{
+    assert(opt);
+
+    int i = m_lookup[(unsigned char)flag];
+    if (i < 0)
         return false;
-    }
-    else if (get_arg(flag, &str)) // check string for true, false, yes, no
-    {
-        if (str && str[0])
-        {
-            if (strcmp(str, "true") == 0 || strcmp(str, "yes") == 0)
-            {
-                *val = true;
-                return true;
-            }
-            else if (strcmp(str, "false") == 0 || strcmp(str, "no") == 0)
-            {
-                *val = false;
-                return true;
-            }
-            else
-            {
-                errno = EINVAL;
-                return false;
-            }
-        }
-        else
-        {
-            errno = EINVAL;
-            return false;
-        }
-    }
-    else
-    {
-        errno = EINVAL;
+
+    *opt = m_opts[m_entries[i].index];
+    return true;
+}
+
+
+OPTIONS_INLINE bool
+frozen_options::get_arg(char flag, const char **param) const
+{
+    assert(param);
+
+    int i = m_lookup[(unsigned char)flag];
+    if (i < 0 || !m_opts[m_entries[i].index].has_arg() ||
+        !m_opts[m_entries[i].index].is_terminated())
         return false;
-    }
 
+    *param = m_opts[m_entries[i].index].arg();
+    return true;
 }
 
 
-inline bool
-options::has_flag(char flag) const
+OPTIONS_INLINE bool
+frozen_options::get_arg(char flag, std::string_view *param) const
 {
-    for (const option &o: m_opts)
-    {
-        if (o.flag() == flag)
-            return true;
-    }
+    assert(param);
+
+    int i = m_lookup[(unsigned char)flag];
+    if (i < 0 || !m_opts[m_entries[i].index].has_arg())
+        return false;
 
-    return false;
+    *param = m_opts[m_entries[i].index].arg_view();
+    return true;
 }
 
 
-inline options
-options::flags() const
+OPTIONS_INLINE bool
+frozen_options::get_arg(char flag, long *val, int *err) const
 {
-    std::vector<option> ret;
-    for (const option &o : m_opts)
-    {
-        if (o.has_flag())
-            ret.emplace_back(o);
-    }
-    return options(std::move(ret));
+    return get(flag, &entry::l, val, err);
 }
 
 
-inline options
-options::args() const
+OPTIONS_INLINE bool
+frozen_options::get_arg(char flag, int *val, int *err) const
 {
-    std::vector<option> ret;
-    for (const option &o : m_opts)
-    {
-        if (o.is_arg_only())
-            ret.emplace_back(o);
-    }
-    
-    return options(std::move(ret));
+    return get(flag, &entry::i, val, err);
+}
+
+
+OPTIONS_INLINE bool
+frozen_options::get_arg(char flag, bool *val, int *err) const
+{
+    return get(flag, &entry::b, val, err);
+}
+
+
+OPTIONS_INLINE bool
+frozen_options::get_arg(char flag, long double *val, int *err) const
+{
+    return get(flag, &entry::ld, val, err);
+}
+
+
+OPTIONS_INLINE bool
+frozen_options::get_arg(char flag, double *val, int *err) const
+{
+    return get(flag, &entry::d, val, err);
 }
 
 
+OPTIONS_INLINE bool
+frozen_options::get_arg(char flag, float *val, int *err) const
+{
+    return get(flag, &entry::f, val, err);
+}
+
 
+#endif /* !OPTIONS_COMPILED || OPTIONS_IMPLEMENTATION */
 
 #endif /* __options_hpp__ */
@@ -0,0 +1,245 @@
+/* ============================================================================
+    options_cache.hpp
+
+    options_cache, a bounded cache of parsed command lines. Kept out of
+    options.hpp so that programs which don't use it don't compile <mutex>,
+    <list> and <unordered_map>.
+
+    MIT License
+    Copyright © 2022 Aaron Ishibashi
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the “Software”),
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+ * ========================================================================= */
+#pragma once
+#ifndef __options_cache_hpp__
+#define __options_cache_hpp__
+#include "options.hpp"
+#include <memory>
+
+/// A bounded cache of parsed command lines, for programs that see the same
+/// few command lines over and over. get() fingerprints argv without
+/// allocating, and on a hit returns the options parsed the first time
+/// instead of tokenizing again. Tokens are compared too, and command lines
+/// whose fingerprints collide are kept side by side. Cached options own
+/// copies of their tokens, so argv need not outlive them. When full, the
+/// least recently used command line is evicted. Safe to use from any
+/// thread; lookups are serialized by a mutex, but parsing on a miss happens
+/// outside it.
+class options_cache {
+public:
+    /// @param capacity maximum number of command lines kept, at least 1
+    explicit options_cache(size_t capacity = 256);
+    ~options_cache();
+
+    options_cache(const options_cache &) = delete;
+    options_cache &operator=(const options_cache &) = delete;
+
+
+    /// @returns the options parsed from argv, shared with every caller that
+    /// passed the same tokens while they were cached. Environment variables
+    /// and config files are not read.
+    [[nodiscard]] std::shared_ptr<const options> get(int argc, char *argv[]);
+
+
+    /// Evicts every command line. Options already returned stay valid.
+    void clear();
+
+
+    /// @returns the number of command lines cached
+    [[nodiscard]] size_t size() const;
+
+    [[nodiscard]] size_t capacity() const { return m_capacity; }
+
+private:
+    struct entry;
+
+    /// The LRU list and fingerprint index. Defined with the other
+    /// definitions, so that compiled mode doesn't pull in <list>,
+    /// <unordered_map> and <mutex>.
+    struct state;
+    std::unique_ptr<state> m_state;
+    size_t m_capacity;
+};
+
+// ========== Definitions ==========
+// Compiled with the definitions in options.hpp: header-only by default, or
+// once in options.cpp when OPTIONS_COMPILED is defined.
+
+#if !defined(OPTIONS_COMPILED) || defined(OPTIONS_IMPLEMENTATION)
+
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+/// A cached command line: a private copy of its tokens, and the options
+/// parsed from them
+struct options_cache::entry {
+    std::unique_ptr<char[]> text;
+    std::vector<char *> argv;
+    options opts;
+
+    /// @returns true if these options were parsed from the same tokens.
+    /// A nullptr token, which the tokenizer reads as an option with neither
+    /// flag nor arg, only matches another nullptr.
+    bool matches(int argc, char *argv_in[]) const
+    {
+        if (argv.size() != (size_t)argc + 1)
+            return false;
+        for (int i = 0; i < argc; ++i)
+        {
+            if (!argv[i] || !argv_in[i])
+            {
+                if (argv[i] != argv_in[i])
+                    return false;
+            }
+            else if (strcmp(argv[i], argv_in[i]) != 0)
+                return false;
+        }
+        return true;
+    }
+};
+
+
+struct options_cache::state {
+    typedef std::list<std::pair<uint64_t, std::shared_ptr<const entry>>> lru_list;
+
+    std::mutex mutex;
+    lru_list lru; // most recently used first
+
+    /// every entry by fingerprint; colliding command lines share a key
+    std::unordered_multimap<uint64_t, lru_list::iterator> index;
+
+    /// @returns the entry parsed from these tokens, or lru.end()
+    lru_list::iterator find(uint64_t key, int argc, char *argv[])
+    {
+        auto range = index.equal_range(key);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (it->second->second->matches(argc, argv))
+                return it->second;
+        }
+        return lru.end();
+    }
+
+    /// Evicts the least recently used entry
+    void evict()
+    {
+        auto last = std::prev(lru.end());
+        auto range = index.equal_range(last->first);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (it->second == last)
+            {
+                index.erase(it);
+                break;
+            }
+        }
+        lru.pop_back();
+    }
+};
+
+
+OPTIONS_INLINE
+options_cache::options_cache(size_t capacity) :
+    m_state(new state()), m_capacity(capacity ? capacity : 1)
+{ }
+
+
+OPTIONS_INLINE
+options_cache::~options_cache() = default;
+
+
+OPTIONS_INLINE std::shared_ptr<const options>
+options_cache::get(int argc, char *argv[])
+{
+    uint64_t key = options::fingerprint(argc, argv);
+
+    {
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        auto found = m_state->find(key, argc, argv);
+        if (found != m_state->lru.end())
+        {
+            m_state->lru.splice(m_state->lru.begin(), m_state->lru, found);
+            const std::shared_ptr<const entry> &e = found->second;
+            return std::shared_ptr<const options>(e, &e->opts);
+        }
+    }
+
+    // Miss: copy the tokens into one block and parse the copy, unlocked;
+    // nullptr tokens stay nullptr
+    size_t bytes = 0;
+    for (int i = 0; i < argc; ++i)
+    {
+        if (argv[i])
+            bytes += strlen(argv[i]) + 1;
+    }
+
+    auto fresh = std::make_shared<entry>();
+    fresh->text.reset(new char[bytes ? bytes : 1]);
+    fresh->argv.resize((size_t)argc + 1, nullptr);
+    char *out = fresh->text.get();
+    for (int i = 0; i < argc; ++i)
+    {
+        if (!argv[i])
+            continue;
+        size_t size = strlen(argv[i]) + 1;
+        memcpy(out, argv[i], size);
+        fresh->argv[i] = out;
+        out += size;
+    }
+    fresh->opts = options(argc, fresh->argv.data());
+
+    std::lock_guard<std::mutex> lock(m_state->mutex);
+    auto found = m_state->find(key, argc, argv);
+    if (found != m_state->lru.end())
+    {
+        // another thread cached it first
+        m_state->lru.splice(m_state->lru.begin(), m_state->lru, found);
+        const std::shared_ptr<const entry> &e = found->second;
+        return std::shared_ptr<const options>(e, &e->opts);
+    }
+
+    m_state->lru.emplace_front(key, fresh);
+    m_state->index.emplace(key, m_state->lru.begin());
+    if (m_state->lru.size() > m_capacity)
+        m_state->evict();
+
+    return std::shared_ptr<const options>(fresh, &fresh->opts);
+}
+
+
+OPTIONS_INLINE void
+options_cache::clear()
+{
+    std::lock_guard<std::mutex> lock(m_state->mutex);
+    m_state->index.clear();
+    m_state->lru.clear();
+}
+
+
+OPTIONS_INLINE size_t
+options_cache::size() const
+{
+    std::lock_guard<std::mutex> lock(m_state->mutex);
+    return m_state->lru.size();
+}
+
+#endif /* !OPTIONS_COMPILED || OPTIONS_IMPLEMENTATION */
+
+#endif /* __options_cache_hpp__ */
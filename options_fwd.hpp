@@ -0,0 +1,61 @@
+/* ============================================================================
+    options_fwd.hpp
+
+    Forward declarations of the classes in options.hpp and its companion
+    headers, for headers that only pass options around by pointer or
+    reference. Includes only <cstddef>.
+
+    MIT License
+    Copyright © 2022 Aaron Ishibashi
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the “Software”),
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+ * ========================================================================= */
+#pragma once
+#ifndef __options_fwd_hpp__
+#define __options_fwd_hpp__
+#include <cstddef>
+
+enum class option_source : unsigned char;
+enum class arg_errc : unsigned char;
+enum class define_policy : unsigned char;
+enum class path_type : unsigned char;
+
+template <typename T>
+class arg_result;
+
+template <typename T, typename Enable = void>
+struct parse_traits;
+
+class option;
+class options;
+class options_cache;
+struct path_status;
+template <std::size_t N>
+class static_options;
+class arg_list;
+template <typename T>
+class typed_arg_list;
+class option_occurrences;
+class argv_array;
+class option_bindings;
+class subcommand_router;
+class frozen_options;
+class reloadable_options;
+
+#endif /* __options_fwd_hpp__ */
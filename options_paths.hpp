@@ -0,0 +1,188 @@
+/* ============================================================================
+    options_paths.hpp
+
+    validate_paths, which checks path args on a pool of threads. Kept out of
+    options.hpp so that programs which don't use it don't compile <thread>.
+
+    MIT License
+    Copyright © 2022 Aaron Ishibashi
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the “Software”),
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+ * ========================================================================= */
+#pragma once
+#ifndef __options_paths_hpp__
+#define __options_paths_hpp__
+#include "options.hpp"
+
+/// What validate_paths found at a path
+enum class path_type : unsigned char {
+    none,      ///< nothing, or it could not be checked
+    regular,   ///< a regular file
+    directory, ///< a directory
+    other      ///< a device, pipe, socket, etc.
+};
+
+/// The result of checking one option's arg as a path
+struct path_status {
+    /// 0 if the path exists, else the errno from stat, e.g. ENOENT or
+    /// EACCES. EINVAL for an option without an arg.
+    int err;
+    path_type type;
+
+    /// the current user may read it
+    bool readable;
+
+    [[nodiscard]] bool exists() const { return err == 0; }
+};
+
+/// Checks the arg of every option as a path, concurrently: whether it
+/// exists, its type, and whether it is readable, i.e. stat and access(R_OK)
+/// for each. Meant for programs taking many paths, e.g. validate_paths(
+/// opts.args()), where checking them one at a time dominates startup.
+/// Paths are handed out to a small pool of threads in chunks; the calling
+/// thread is one of them. Symbolic links are followed.
+/// @param opts the options whose args are paths
+/// @param threads number of threads, or 0 for one per hardware thread.
+/// Checks mostly wait on the file system, so on network mounts more threads
+/// than cores can help. Fewer are used if opts is small.
+/// @returns one status per option, in the same order
+[[nodiscard]] std::vector<path_status> validate_paths(const options &opts, unsigned threads = 0);
+
+// ========== Definitions ==========
+// Compiled with the definitions in options.hpp: header-only by default, or
+// once in options.cpp when OPTIONS_COMPILED is defined.
+
+#if !defined(OPTIONS_COMPILED) || defined(OPTIONS_IMPLEMENTATION)
+
+#include <algorithm>
+#include <atomic>
+#include <system_error>
+#include <thread>
+
+#include <sys/stat.h>
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace options_detail {
+    /// stat and access for one path of validate_paths
+    OPTIONS_INLINE path_status
+    check_path(const char *path)
+    {
+        path_status status {0, path_type::none, false};
+
+#if defined(_WIN32)
+        struct _stat64 st;
+        if (_stat64(path, &st) != 0)
+        {
+            status.err = errno;
+            return status;
+        }
+
+        if (st.st_mode & _S_IFDIR)
+            status.type = path_type::directory;
+        else if (st.st_mode & _S_IFREG)
+            status.type = path_type::regular;
+        else
+            status.type = path_type::other;
+        status.readable = _access(path, 4) == 0;
+#else
+        struct stat st;
+        if (stat(path, &st) != 0)
+        {
+            status.err = errno;
+            return status;
+        }
+
+        if (S_ISREG(st.st_mode))
+            status.type = path_type::regular;
+        else if (S_ISDIR(st.st_mode))
+            status.type = path_type::directory;
+        else
+            status.type = path_type::other;
+        status.readable = access(path, R_OK) == 0;
+#endif
+
+        return status;
+    }
+}
+
+
+OPTIONS_INLINE std::vector<path_status>
+validate_paths(const options &opts, unsigned threads)
+{
+    // big enough to amortize the shared counter, small enough to balance
+    const size_t chunk = 64;
+    const size_t n = opts.size();
+    std::vector<path_status> results(n, path_status {EINVAL, path_type::none, false});
+
+    std::atomic<size_t> next(0);
+    auto work = [&]()
+    {
+        // args need not be NUL-terminated, e.g. views into a buffer
+        std::string path;
+        for (;;)
+        {
+            size_t first = next.fetch_add(chunk, std::memory_order_relaxed);
+            if (first >= n)
+                return;
+
+            size_t last = std::min(n, first + chunk);
+            for (size_t i = first; i < last; ++i)
+            {
+                const option &o = opts[(int)i];
+                if (!o.has_arg())
+                    continue;
+
+                path.assign(o.arg_view());
+                results[i] = options_detail::check_path(path.c_str());
+            }
+        }
+    };
+
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = (unsigned)std::min<size_t>(threads, (n + chunk - 1) / chunk);
+
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads; ++t)
+    {
+        // if no more threads can be started, make do with those running
+        try
+        {
+            pool.emplace_back(work);
+        }
+        catch (const std::system_error &)
+        {
+            break;
+        }
+    }
+
+    work();
+    for (std::thread &t : pool)
+        t.join();
+
+    return results;
+}
+
+#endif /* !OPTIONS_COMPILED || OPTIONS_IMPLEMENTATION */
+
+#endif /* __options_paths_hpp__ */
@@ -0,0 +1,320 @@
+/* ============================================================================
+    options_reload.hpp
+
+    reloadable_options, for options that a reloader replaces while other
+    threads keep reading. Kept out of options.hpp so that programs which
+    don't use it don't compile <mutex>.
+
+    MIT License
+    Copyright © 2022 Aaron Ishibashi
+
+    Permission is hereby granted, free of charge, to any person obtaining a 
+    copy of this software and associated documentation files (the “Software”),
+    to deal in the Software without restriction, including without limitation 
+    the rights to use, copy, modify, merge, publish, distribute, sublicense, 
+    and/or sell copies of the Software, and to permit persons to whom the 
+    Software is furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in 
+    all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+    FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+    DEALINGS IN THE SOFTWARE.
+ * ========================================================================= */
+#pragma once
+#ifndef __options_reload_hpp__
+#define __options_reload_hpp__
+#include "options.hpp"
+
+/// Holds a long-running program's current options and lets a reloader
+/// replace them, e.g. after SIGHUP, while other threads keep reading.
+///
+/// Readers call acquire() to pin the current options. This is lock-free and
+/// never waits for a reload: it publishes the pointer in a hazard slot and
+/// re-checks it, nothing more. publish() swaps in new options atomically and
+/// retires the old ones, which are deleted once no hazard slot refers to
+/// them. Build the new options on the reloader's thread, not in a signal
+/// handler; the handler should only wake the reloader.
+class reloadable_options {
+    /// One reader's published options pointer, and whether a snapshot holds
+    /// the slot. Defined with the other definitions, like state.
+    struct hazard_slot;
+
+public:
+    /// A reader's pinned view of the options. The options it points to stay
+    /// alive until it is destroyed, even if a reload replaces them.
+    class snapshot {
+    public:
+        snapshot(snapshot &&other) noexcept :
+            m_slot(other.m_slot), m_opts(other.m_opts)
+        {
+            other.m_slot = nullptr;
+            other.m_opts = nullptr;
+        }
+
+        snapshot(const snapshot &) = delete;
+        snapshot &operator=(const snapshot &) = delete;
+        snapshot &operator=(snapshot &&) = delete;
+
+        /// Releases the hazard slot
+        ~snapshot();
+
+        [[nodiscard]] const options &operator*() const { return *m_opts; }
+        [[nodiscard]] const options *operator->() const { return m_opts; }
+        [[nodiscard]] const options *get() const { return m_opts; }
+
+    private:
+        friend class reloadable_options;
+        snapshot(hazard_slot *slot, const options *opts) :
+            m_slot(slot), m_opts(opts) { }
+
+        hazard_slot *m_slot;
+        const options *m_opts;
+    };
+
+    /// @param initial the options to start with
+    /// @param max_readers maximum number of snapshots alive at once. When all
+    /// are taken, acquire() spins until one is released.
+    explicit reloadable_options(options initial, size_t max_readers = 128);
+
+    /// All snapshots must have been released.
+    ~reloadable_options();
+
+    reloadable_options(const reloadable_options &) = delete;
+    reloadable_options &operator=(const reloadable_options &) = delete;
+
+
+    /// Pins the current options. Lock-free; safe to call from any thread.
+    [[nodiscard]] snapshot acquire() const;
+
+
+    /// Replaces the current options. Readers holding a snapshot keep the old
+    /// options until they release it; new snapshots see next. Reloaders are
+    /// serialized with each other but never block readers.
+    void publish(options next);
+
+
+    /// Publishes next unless it holds the same options as the current ones,
+    /// e.g. after reloading a config file nobody edited. A differing
+    /// fingerprint rules out a match without comparing the options.
+    /// @returns true if next was published
+    bool publish_if_changed(options next);
+
+
+    /// Deletes retired options that no reader still holds. publish() calls
+    /// this itself; call it to free memory sooner after readers finish.
+    void reclaim();
+
+
+    /// @returns the number of replaced options not yet deleted
+    [[nodiscard]] size_t retired() const;
+
+private:
+    void reclaim_locked();
+
+    /// The current options, the hazard slots, and the reloader-only mutex
+    /// and retired options. Defined with the other definitions, so that
+    /// compiled mode doesn't pull in <atomic> and <mutex>.
+    struct state;
+    state *m_state;
+};
+
+// ========== Definitions ==========
+// Compiled with the definitions in options.hpp: header-only by default, or
+// once in options.cpp when OPTIONS_COMPILED is defined.
+
+#if !defined(OPTIONS_COMPILED) || defined(OPTIONS_IMPLEMENTATION)
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+namespace options_detail {
+    /// @returns true if a and b hold the same flags, flag tokens, sources and
+    /// args, in the same order
+    OPTIONS_INLINE bool
+    same_options(const options &a, const options &b)
+    {
+        if (a.size() != b.size())
+            return false;
+
+        for (size_t i = 0; i < a.size(); ++i)
+        {
+            const option &x = a[(int)i];
+            const option &y = b[(int)i];
+            if (x.flag() != y.flag() || x.source() != y.source() ||
+                x.has_arg() != y.has_arg() || x.arg_view() != y.arg_view() ||
+                flag_token_rest(x) != flag_token_rest(y))
+                return false;
+        }
+
+        return true;
+    }
+}
+
+
+struct alignas(64) reloadable_options::hazard_slot {
+    std::atomic<const options *> ptr{nullptr};
+    std::atomic<bool> claimed{false};
+};
+
+
+struct reloadable_options::state {
+    /// read by every acquire(), so kept off the reloaders' cache line
+    alignas(64) std::atomic<const options *> current{nullptr};
+    std::unique_ptr<hazard_slot[]> slots;
+    size_t slot_count = 0;
+
+    /// reloader-only: serializes reloaders, and holds the retired options
+    alignas(64) std::mutex mutex;
+    std::vector<const options *> retired;
+};
+
+
+OPTIONS_INLINE
+reloadable_options::snapshot::~snapshot()
+{
+    if (m_slot)
+    {
+        m_slot->ptr.store(nullptr, std::memory_order_release);
+        m_slot->claimed.store(false, std::memory_order_release);
+    }
+}
+
+
+OPTIONS_INLINE
+reloadable_options::reloadable_options(options initial, size_t max_readers) :
+    m_state()
+{
+    std::unique_ptr<state> fresh(new state());
+    fresh->slot_count = max_readers ? max_readers : 1;
+    fresh->slots.reset(new hazard_slot[fresh->slot_count]);
+    fresh->current.store(new options(std::move(initial)));
+    m_state = fresh.release();
+}
+
+
+OPTIONS_INLINE
+reloadable_options::~reloadable_options()
+{
+    for (size_t i = 0; i < m_state->slot_count; ++i)
+        assert(!m_state->slots[i].claimed.load() && "snapshot outlived its reloadable_options");
+
+    delete m_state->current.load();
+    for (const options *o : m_state->retired)
+        delete o;
+    delete m_state;
+}
+
+
+OPTIONS_INLINE reloadable_options::snapshot
+reloadable_options::acquire() const
+{
+    // start where this thread last found a free slot
+    static thread_local size_t hint = 0;
+
+    size_t i = hint % m_state->slot_count;
+    for (;; i = (i + 1) % m_state->slot_count)
+    {
+        hazard_slot &slot = m_state->slots[i];
+        if (!slot.claimed.load(std::memory_order_relaxed) &&
+            !slot.claimed.exchange(true, std::memory_order_acquire))
+            break;
+    }
+    hint = i;
+
+    // Publish the hazard, then make sure it's still current: once the
+    // re-check passes, a reloader's scan is guaranteed to see the hazard.
+    hazard_slot &slot = m_state->slots[i];
+    const options *opts = m_state->current.load();
+    for (;;)
+    {
+        slot.ptr.store(opts);
+        const options *current = m_state->current.load();
+        if (current == opts)
+            break;
+        opts = current;
+    }
+
+    return snapshot(&slot, opts);
+}
+
+
+OPTIONS_INLINE void
+reloadable_options::publish(options next)
+{
+    const options *fresh = new options(std::move(next));
+
+    std::lock_guard<std::mutex> lock(m_state->mutex);
+    m_state->retired.push_back(m_state->current.exchange(fresh));
+    reclaim_locked();
+}
+
+
+OPTIONS_INLINE bool
+reloadable_options::publish_if_changed(options next)
+{
+    std::lock_guard<std::mutex> lock(m_state->mutex);
+
+    // only reloaders retire the current options, so it is safe to read here
+    const options *current = m_state->current.load();
+    if (current->fingerprint() == next.fingerprint() &&
+        options_detail::same_options(*current, next))
+        return false;
+
+    m_state->retired.push_back(m_state->current.exchange(new options(std::move(next))));
+    reclaim_locked();
+    return true;
+}
+
+
+OPTIONS_INLINE void
+reloadable_options::reclaim()
+{
+    std::lock_guard<std::mutex> lock(m_state->mutex);
+    reclaim_locked();
+}
+
+
+OPTIONS_INLINE size_t
+reloadable_options::retired() const
+{
+    std::lock_guard<std::mutex> lock(m_state->mutex);
+    return m_state->retired.size();
+}
+
+
+OPTIONS_INLINE void
+reloadable_options::reclaim_locked()
+{
+    std::vector<const options *> &retired = m_state->retired;
+    size_t kept = 0;
+    for (const options *o : retired)
+    {
+        bool in_use = false;
+        for (size_t i = 0; i < m_state->slot_count; ++i)
+        {
+            if (m_state->slots[i].ptr.load() == o)
+            {
+                in_use = true;
+                break;
+            }
+        }
+
+        if (in_use)
+            retired[kept++] = o;
+        else
+            delete o;
+    }
+
+    retired.resize(kept);
+}
+
+#endif /* !OPTIONS_COMPILED || OPTIONS_IMPLEMENTATION */
+
+#endif /* __options_reload_hpp__ */
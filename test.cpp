@@ -1,6 +1,11 @@
 #include "options.hpp"
+#include "options_cache.hpp"
+#include "options_paths.hpp"
+#include "options_reload.hpp"
+#include <array>
 #include <iostream>
 #include <sstream>
+#include <sys/stat.h>
 
 /// Test suite functions
 int test_main(int argc, char *argv[]);
@@ -11,6 +16,39 @@ void assert_equal<const char *>(const char *actual, const char *expected, const
 template <>
 void assert_equal<bool>(bool actual, bool expected, const char *test_name);
 
+/// Custom type read through parse_traits
+enum class level { low, high };
+
+template <>
+struct parse_traits<level> {
+    static arg_result<level> parse(std::string_view arg)
+    {
+        if (arg == "low")
+            return level::low;
+        if (arg == "high")
+            return level::high;
+        return arg_errc::invalid;
+    }
+};
+
+/// Subcommand handlers, recording what they were called with
+static std::string last_subcommand;
+static size_t last_subcommand_size;
+
+static int run_subcommand(const options &opts)
+{
+    last_subcommand = opts[0].arg();
+    last_subcommand_size = opts.size();
+    return (int)last_subcommand.size();
+}
+
+static int run_remote_add(const options &opts)
+{
+    last_subcommand = std::string("remote ") + opts[0].arg();
+    last_subcommand_size = opts.size();
+    return 42;
+}
+
 static int tests_passed;
 static int tests_ran;
 
@@ -157,6 +195,33 @@ int test_main(int argc, char *argv[])
         assert_equal(p_options.empty(), true, "get_options received 0 options on false return");
     }
 
+    // Grouped occurrences
+    {
+        option opt;
+        bool result;
+
+        assert_equal(opts.count('h'), (size_t)2, "count: two 'h' options");
+        assert_equal(opts.count('n'), (size_t)1, "count: one 'n' option");
+        assert_equal(opts.count('p'), (size_t)0, "count: no 'p' options");
+        assert_equal(opts.count('\0'), (size_t)1, "count: one arg-only option");
+
+        result = opts.get_option('h', 1, &opt);
+        assert_equal(result && opt.index() == 22, true, "get_option nth: finds second 'h' option");
+        result = opts.get_option('h', 2, &opt);
+        assert_equal(result, false, "get_option nth: false past last occurrence");
+
+        result = opts.get_last_option('h', &opt);
+        assert_equal(result && opt.arg_view() == "20", true, "get_last_option: last 'h' option wins");
+        result = opts.get_last_option('p', &opt);
+        assert_equal(result, false, "get_last_option: false on missing flag");
+
+        std::string h_args;
+        for (const option &o : opts.occurrences('h'))
+            h_args.append(o.arg_view()).append(" ");
+        assert_equal(h_args == "0 20 ", true, "occurrences: visits each 'h' option in order");
+        assert_equal(opts.occurrences('p').empty(), true, "occurrences: empty on missing flag");
+    }
+
     // Find a specific flag's parameter: found
     {
         const char *filepath = "default_file.txt";
@@ -340,6 +405,672 @@ int test_main(int argc, char *argv[])
         assert_equal(result, false, "get_arg bool: \"10\" returns false");
     }
 
+    // string_view accessors
+    {
+        std::string_view view;
+        bool result = opts.get_arg('o', &view);
+        assert_equal(result, true, "get_arg string_view: returns true when found");
+        assert_equal(view == "test_file.txt", true, "get_arg string_view: view matches arg");
+        assert_equal(opts[1].arg_size(), strlen("test_file.txt"), "option caches arg length");
+        assert_equal(opts[2].arg_view().empty(), true, "option without arg has empty view");
+
+        view = "default";
+        result = opts.get_arg('f', &view);
+        assert_equal(result, false, "get_arg string_view: returns false on flag without arg");
+        assert_equal(view == "default", true, "get_arg string_view: un-mutated on false");
+    }
+
+    // parse_arg results
+    {
+        errno = 0;
+        assert_equal(opts.parse_arg<int>('n').value(), 10, "parse_arg int: parsed from arg");
+        assert_equal(opts.parse_arg<int>('z').error() == arg_errc::missing_flag, true, "parse_arg int: missing flag");
+        assert_equal(opts.parse_arg<int>('f').error() == arg_errc::no_argument, true, "parse_arg int: flag without arg");
+        assert_equal(opts.parse_arg<long>('o').error() == arg_errc::invalid, true, "parse_arg long: invalid arg");
+        assert_equal(opts.parse_arg<long>('q').error() == arg_errc::out_of_range, true, "parse_arg long: out of range");
+        assert_equal(opts.parse_arg<int>('r').error() == arg_errc::out_of_range, true, "parse_arg int: out of range < min");
+        assert_equal(opts.parse_arg<double>('q').error() == arg_errc::out_of_range, true, "parse_arg double: out of range");
+        assert_equal(opts.parse_arg<float>('o').error() == arg_errc::invalid, true, "parse_arg float: invalid arg");
+        assert_equal(opts.parse_arg<double>('n').value(), 10.0, "parse_arg double: parsed from arg");
+        assert_equal(opts.parse_arg<bool>('b').value(), true, "parse_arg bool: \"yes\" gets true");
+        assert_equal(opts.parse_arg<bool>('n').error() == arg_errc::out_of_range, true, "parse_arg bool: \"10\" out of range");
+        assert_equal(opts.parse_arg<std::string_view>('o').value() == "test_file.txt", true, "parse_arg string_view: gets arg");
+        assert_equal(opts.parse_arg<const char *>('o').value(), "test_file.txt", "parse_arg c-string: gets arg");
+        assert_equal(opts.parse_arg<int>('z').value_or(7), 7, "parse_arg: value_or falls back on error");
+        assert_equal(errno, 0, "parse_arg: errno untouched");
+
+        bool check = true;
+        bool result = opts.get_arg('z', &check);
+        assert_equal(result, false, "get_arg bool: returns false on missing flag");
+        assert_equal(errno, 0, "get_arg bool: errno untouched on missing flag");
+    }
+
+    // Hex floating point args, as strtod reads them
+    {
+        const char *hex_argv[] {"program", "-x", "0x10", "-y", "-0X1.8p1", "-z", "0xg", "-w", "0x1p99999"};
+        options hex(9, (char **)hex_argv);
+        double d = -1;
+
+        assert_equal(hex.get_arg('x', &d) && d == 16.0, true, "hex float: 0x10 is 16");
+        assert_equal(hex.parse_arg<float>('y').value(), -3.0f, "hex float: signed with exponent");
+        assert_equal(hex.parse_arg<double>('z').value(), 0.0, "hex float: prefix without digits reads 0");
+        assert_equal(hex.parse_arg<double>('w').error() == arg_errc::out_of_range, true, "hex float: out of range");
+    }
+
+    // parse_traits conversions
+    {
+        short s = -1;
+        unsigned long long ull = 0;
+        bool result;
+
+        result = opts.get_arg('n', &s);
+        assert_equal(result && s == 10, true, "get_arg short: parsed through built-in traits");
+        result = opts.get_arg('n', &ull);
+        assert_equal(result && ull == 10ULL, true, "get_arg unsigned long long: parsed through built-in traits");
+
+        errno = 0;
+        result = opts.get_arg('r', &ull);
+        assert_equal(result, false, "get_arg unsigned long long: negative arg fails");
+        assert_equal(errno, EINVAL, "get_arg unsigned long long: negative arg is EINVAL");
+
+        char *level_argv[] {(char *)"program", (char *)"-l", (char *)"high", (char *)"-m", (char *)"medium"};
+        options level_opts(5, level_argv);
+        level lvl = level::low;
+        result = level_opts.get_arg('l', &lvl);
+        assert_equal(result && lvl == level::high, true, "get_arg custom type: parsed through user traits");
+        assert_equal(level_opts.parse_arg<level>('m').error() == arg_errc::invalid, true, "parse_arg custom type: reports invalid");
+        assert_equal(level_opts.parse_arg<level>('x').error() == arg_errc::missing_flag, true, "parse_arg custom type: reports missing flag");
+    }
+
+    // Delimited lists
+    {
+        char *list_argv[] {(char *)"program", (char *)"-I", (char *)"inc,src,,lib", (char *)"-c", (char *)"0:2:x:4", (char *)"-e", (char *)""};
+        options list_opts(7, list_argv);
+
+        const char *expected[] {"inc", "src", "", "lib"};
+        size_t count = 0;
+        bool segments_correct = true;
+        for (std::string_view segment : list_opts.get_list('I'))
+        {
+            if (count >= 4 || segment != expected[count])
+                segments_correct = false;
+            if (segment.data() < list_argv[2] || segment.data() > list_argv[2] + strlen(list_argv[2]))
+                segments_correct = false;
+            ++count;
+        }
+        assert_equal(count, (size_t)4, "get_list: visits every segment");
+        assert_equal(segments_correct, true, "get_list: segments are views into argv");
+
+        assert_equal(list_opts.get_list('z').empty(), true, "get_list: missing flag gives empty list");
+        assert_equal(list_opts.get_list('z').begin() == list_opts.get_list('z').end(), true, "get_list: empty list has no segments");
+
+        count = 0;
+        for (std::string_view segment : list_opts.get_list('e'))
+        {
+            if (segment.empty())
+                ++count;
+        }
+        assert_equal(count, (size_t)1, "get_list: empty arg has one empty segment");
+
+        long sum = 0;
+        size_t errors = 0;
+        for (arg_result<long> n : list_opts.get_list<long>('c', ':'))
+        {
+            if (n)
+                sum += n.value();
+            else if (n.error() == arg_errc::invalid)
+                ++errors;
+        }
+        assert_equal(sum, 6L, "get_list typed: parses each segment");
+        assert_equal(errors, (size_t)1, "get_list typed: reports invalid segments");
+    }
+
+    // Runtime bindings
+    {
+        option_bindings bindings;
+        int number = -1;
+        const char *path = nullptr;
+        bool verbose = true;
+        bool check = false;
+        double threshold = -1.0;
+        long big = -1;
+        int missing = -1;
+        int replaced = -1;
+
+        bindings.bind('h', &replaced);
+        bindings.bind('o', &path, "default_file.txt");
+        bindings.bind_flag('f', &verbose);
+        bindings.bind('b', &check);
+        bindings.bind('x', &threshold, 0.5);
+        bindings.bind('q', &big, 7); // the default converts to dest's type
+        bindings.bind('t', &missing, 3);
+        bindings.bind('h', &number); // rebinding replaces the first binding
+        assert_equal(bindings.size(), (size_t)7, "bindings: rebinding a flag replaces it");
+
+        std::vector<option_bindings::error> errors;
+        bool result = bindings.apply(opts, &errors);
+        assert_equal(result, false, "bindings: apply reports failure");
+        assert_equal(number, 0, "bindings: first 'h' option applied");
+        assert_equal(replaced, -1, "bindings: replaced binding not applied");
+        assert_equal(path, "test_file.txt", "bindings: c-string applied");
+        assert_equal(verbose, true, "bindings: flag presence applied");
+        assert_equal(check, true, "bindings: bool applied");
+        assert_equal(threshold, 0.5, "bindings: missing flag gets default");
+        assert_equal(missing, 3, "bindings: missing int flag gets default");
+        assert_equal(big, 7L, "bindings: failed conversion keeps default");
+        assert_equal(errors.size(), (size_t)1, "bindings: one error reported");
+        assert_equal(!errors.empty() && errors[0].flag == 'q' &&
+                     errors[0].err == arg_errc::out_of_range, true, "bindings: error names flag and reason");
+
+        options empty_opts;
+        result = bindings.apply(empty_opts);
+        assert_equal(result, true, "bindings: apply succeeds with no options");
+        assert_equal(verbose, false, "bindings: reapply resets flag");
+        assert_equal(path, "default_file.txt", "bindings: reapply resets to default");
+    }
+
+    // Subcommand routing
+    {
+        subcommand_router remote;
+        remote.add("add", run_remote_add);
+
+        subcommand_router router;
+        const char *names[] {"init", "status", "commit", "push", "pull", "fetch", "log", "diff",
+                             "merge", "rebase", "reset", "tag", "branch", "checkout", "clone", "show"};
+        for (const char *name : names)
+            router.add(name, run_subcommand);
+        router.add("remote", &remote);
+        router.build();
+
+        bool all_found = true;
+        for (const char *name : names)
+            all_found = all_found && router.contains(name);
+        assert_equal(all_found, true, "subcommands: every name resolves");
+        assert_equal(router.contains("stat"), false, "subcommands: prefix does not resolve");
+        assert_equal(router.contains("statuses"), false, "subcommands: unknown name does not resolve");
+
+        int result = -1;
+        char *commit_argv[] {(char *)"tool", (char *)"commit", (char *)"-m", (char *)"message"};
+        bool ran = router.dispatch(4, commit_argv, &result);
+        assert_equal(ran, true, "subcommands: dispatch runs handler");
+        assert_equal(last_subcommand == "commit", true, "subcommands: handler gets its own name as opts[0]");
+        assert_equal(last_subcommand_size, (size_t)2, "subcommands: handler gets only its slice");
+        assert_equal(result, 6, "subcommands: dispatch returns handler's result");
+
+        char *nested_argv[] {(char *)"tool", (char *)"remote", (char *)"add", (char *)"-u", (char *)"url"};
+        ran = router.dispatch(5, nested_argv, &result);
+        assert_equal(ran && result == 42, true, "subcommands: nested router dispatches");
+        assert_equal(last_subcommand == "remote add", true, "subcommands: nested handler gets its own name");
+
+        result = -1;
+        char *unknown_argv[] {(char *)"tool", (char *)"frobnicate"};
+        ran = router.dispatch(2, unknown_argv, &result);
+        assert_equal(ran, false, "subcommands: unknown subcommand not run");
+        assert_equal(result, -1, "subcommands: result un-mutated when not run");
+        ran = router.dispatch(1, unknown_argv, &result);
+        assert_equal(ran, false, "subcommands: missing subcommand not run");
+    }
+
+    // Editing and argv emission
+    {
+        char *edit_argv[] {(char *)"launcher", (char *)"-v", (char *)"-o", (char *)"out.txt",
+                           (char *)"-x", (char *)"1", (char *)"-x", (char *)"2", (char *)"input.txt"};
+        options edit(9, edit_argv);
+
+        assert_equal(edit.remove('v'), (size_t)1, "remove: removes flag");
+        assert_equal(edit.has_flag('v'), false, "remove: flag no longer found");
+        assert_equal(edit.remove('v'), (size_t)0, "remove: nothing left to remove");
+
+        std::string value = "3";
+        edit.set_arg('x', value);
+        value = "overwritten";
+        assert_equal(edit.count('x'), (size_t)1, "set_arg: leaves one option with the flag");
+        assert_equal(edit.parse_arg<int>('x').value(), 3, "set_arg: overrides arg with a copy");
+
+        edit.set_arg('j', "8");
+        edit.insert(1, 'q');
+        edit.insert(0, '\0', "child");
+        assert_equal(edit[0].arg(), "child", "insert: arg-only option at front");
+
+        options copy = edit;
+        copy.set_arg('j', "16");
+        assert_equal(edit.parse_arg<int>('j').value(), 8, "set_arg: copies do not share edits");
+
+        argv_array child;
+        assert_equal(edit.to_argv(&child), true, "to_argv: edited command line emitted");
+        const char *expected[] {"child", "launcher", "-q", "-o", "out.txt", "-x", "3", "input.txt", "-j", "8"};
+        bool args_correct = child.argc() == 10;
+        for (int i = 0; args_correct && i < 10; ++i)
+            args_correct = strcmp(child.argv()[i], expected[i]) == 0;
+        assert_equal(args_correct, true, "to_argv: emits edited command line");
+        assert_equal(child.argv()[child.argc()], (char *)nullptr, "to_argv: array is nullptr-terminated");
+        assert_equal(child.argv()[4], edit_argv[3], "to_argv: unchanged args reused by pointer");
+        assert_equal(child.argv()[3], edit_argv[2], "to_argv: unchanged flags reused by pointer");
+
+        // whole flag tokens are passed on, not just their flags
+        char *cc_argv[] {(char *)"cc", (char *)"-O2", (char *)"-Wall", (char *)"main.c", (char *)"-DNDEBUG=1", (char *)"-c"};
+        options cc(6, cc_argv);
+        argv_array cc_child;
+        bool same_tokens = cc.to_argv(&cc_child) && cc_child.argc() == 6;
+        for (int i = 0; same_tokens && i < 6; ++i)
+            same_tokens = cc_child.argv()[i] == cc_argv[i];
+        assert_equal(same_tokens, true, "to_argv: unedited command line passed on token for token");
+        assert_equal(cc[1].flag_token() == "-O2" && cc[3].has_attached_arg(), true, "to_argv: flag tokens recorded");
+        cc.set_arg('W', "other.c");
+        assert_equal(cc.to_argv(&cc_child) && strcmp(cc_child.argv()[2], "-Wall") == 0 &&
+                     strcmp(cc_child.argv()[3], "other.c") == 0, true, "set_arg: keeps the flag token");
+        cc.set_arg('D', "NDEBUG=0");
+        assert_equal(cc.to_argv(&cc_child) && strcmp(cc_child.argv()[4], "-D") == 0 &&
+                     strcmp(cc_child.argv()[5], "NDEBUG=0") == 0, true, "set_arg: drops a token holding the old arg");
+
+        // edits that the child would read differently are refused
+        char *pair_argv[] {(char *)"prog", (char *)"-f", (char *)"-o", (char *)"out", (char *)"file"};
+        options paired(5, pair_argv);
+        argv_array unchanged;
+        paired.remove('o');
+        assert_equal(paired.to_argv(&unchanged), false, "to_argv: flag before an arg-only option refused");
+        assert_equal(unchanged.argv(), (char *const *)nullptr, "to_argv: refused array left untouched");
+        paired.insert(2, 'g', "value");
+        assert_equal(paired.to_argv(&unchanged) && unchanged.argc() == 5, true, "to_argv: flag followed by a flag emitted");
+        paired.set_arg('g', "-v");
+        assert_equal(paired.to_argv(&unchanged), false, "to_argv: arg reading as a flag refused");
+    }
+
+    // Moved-from containers are empty
+    {
+        char *move_argv[] {(char *)"program", (char *)"-o", (char *)"out.txt"};
+        options source(3, move_argv);
+        options moved = std::move(source);
+        option opt;
+        const char *str = nullptr;
+
+        assert_equal(moved.get_arg('o', &str) && strcmp(str, "out.txt") == 0, true, "move: target has the options");
+        assert_equal(source.size(), (size_t)0, "move: source is empty");
+        assert_equal(source.has_flag('o'), false, "move: source has no flags");
+        assert_equal(source.get_option('o', &opt) || source.get_arg('o', &str), false, "move: source lookups fail");
+        assert_equal(source.count('o'), (size_t)0, "move: source counts nothing");
+
+        options assigned;
+        assigned = std::move(moved);
+        assert_equal(assigned.has_flag('o') && !moved.has_flag('o'), true, "move assignment: source is empty");
+        assert_equal(moved.fingerprint(), options().fingerprint(), "move: source fingerprint is empty");
+    }
+
+    // Token ranges
+    {
+        char *range_argv[] {(char *)"svc", (char *)"-o", (char *)"out.txt", (char *)"-v", (char *)"input"};
+        const uint64_t expected = options(5, range_argv).fingerprint();
+
+        const std::vector<std::string> strings {"svc", "-o", "out.txt", "-v", "input"};
+        options from_strings(strings);
+        assert_equal(from_strings.fingerprint(), expected, "token range: strings parse like argv");
+        assert_equal(from_strings[1].arg(), strings[2].c_str(), "token range: args point into the strings");
+
+        // views into one flat buffer, without terminators between tokens
+        const char buffer[] = "svc-oout.txt-vinput";
+        const std::string_view views[] {{buffer, 3}, {buffer + 3, 2}, {buffer + 5, 7}, {buffer + 12, 2}, {buffer + 14, 5}};
+        options from_views(views);
+        assert_equal(from_views.fingerprint(), expected, "token range: views parse like argv");
+        std::string_view out;
+        assert_equal(from_views.get_arg('o', &out) && out == "out.txt", true, "token range: view arg has its own length");
+        assert_equal(from_views[2].index() == 3 && from_views[2].arg_view() == "input", true, "token range: index is token position");
+
+        // unterminated args never leak out as c-strings
+        const char *c_string = nullptr;
+        assert_equal(from_views[1].is_terminated() || !from_strings[1].is_terminated(), false, "token range: views are unterminated, strings are not");
+        assert_equal(from_views.parse_arg<const char *>('o').error() == arg_errc::invalid, true, "token range: c-string of a view is invalid");
+        assert_equal(from_views.get_arg('o', &c_string), false, "token range: get_arg c-string of a view fails");
+        assert_equal(frozen_options(from_views).get_arg('o', &c_string), false, "token range: frozen c-string of a view fails");
+        option_bindings view_bindings;
+        view_bindings.bind('o', &c_string);
+        std::vector<option_bindings::error> binding_errors;
+        assert_equal(view_bindings.apply(from_views, &binding_errors) || binding_errors[0].err != arg_errc::invalid, false,
+                     "token range: c-string binding of a view is invalid");
+        argv_array view_argv;
+        assert_equal(from_views.to_argv(&view_argv), true, "token range: to_argv of views");
+        assert_equal((const char *)view_argv.argv()[1], "-o", "token range: to_argv terminates view flags");
+        assert_equal((const char *)view_argv.argv()[2], "out.txt", "token range: to_argv terminates view args");
+        assert_equal((const char *)view_argv.argv()[4], "input", "token range: to_argv terminates the last view arg");
+        assert_equal(from_strings.get_arg('o', &c_string) && c_string == strings[2].c_str(), true, "token range: string args are c-strings");
+
+        const std::pair<const char *, size_t> pairs[] {{buffer, 3}, {buffer + 3, 2}, {buffer + 5, 7}, {buffer + 12, 2}, {buffer + 14, 5}};
+        assert_equal(options(pairs).fingerprint(), expected, "token range: (pointer, length) pairs parse like argv");
+
+        const std::vector<std::string_view> numbers {"-n", "42"};
+        assert_equal(options(numbers).parse_arg<int>('n').value(), 42, "token range: typed lookup on view args");
+
+        static_assert(!std::is_constructible_v<options, std::vector<std::string>>, "token range: temporary ranges rejected");
+        static_assert(!std::is_constructible_v<options, std::vector<int>>, "token range: non-token ranges rejected");
+    }
+
+    // Path validation
+    {
+        mkdir("options_test_dir", 0755);
+        FILE *file = fopen("options_test_dir/file.txt", "w");
+        fclose(file);
+
+        std::vector<std::string> paths {"tool", "options_test_dir/file.txt", "options_test_dir",
+                                        "options_test_dir/missing.txt"};
+        for (int i = 0; i < 1000; ++i)
+            paths.push_back(i % 2 ? "options_test_dir/file.txt" : "options_test_dir/nothing");
+        paths.push_back("-v");
+
+        options path_opts(paths);
+        std::vector<path_status> statuses = validate_paths(path_opts, 4);
+        assert_equal(statuses.size(), path_opts.size(), "validate_paths: one status per option");
+        assert_equal(statuses[1].exists() && statuses[1].type == path_type::regular && statuses[1].readable, true,
+                     "validate_paths: readable regular file");
+        assert_equal(statuses[2].type == path_type::directory, true, "validate_paths: directory");
+        assert_equal(statuses[3].err == ENOENT && !statuses[3].readable, true, "validate_paths: missing file");
+        assert_equal(statuses.back().err, EINVAL, "validate_paths: flag without arg");
+
+        std::vector<path_status> serial = validate_paths(path_opts, 1);
+        bool same = true;
+        for (size_t i = 0; i < statuses.size(); ++i)
+        {
+            same = same && statuses[i].err == serial[i].err && statuses[i].type == serial[i].type &&
+                statuses[i].readable == serial[i].readable;
+        }
+        assert_equal(same, true, "validate_paths: threads agree with one thread");
+        assert_equal(validate_paths(options()).empty(), true, "validate_paths: no options");
+
+        remove("options_test_dir/file.txt");
+        remove("options_test_dir");
+    }
+
+    // Defines
+    {
+        char *define_argv[] {(char *)"cc", (char *)"-DFOO=1", (char *)"-D", (char *)"BAR=two",
+                             (char *)"-DFOO=3", (char *)"-DBAZ", (char *)"-DEMPTY=", (char *)"-o", (char *)"a.out"};
+        options defines(9, define_argv);
+        std::string_view value;
+
+        assert_equal(defines.count('D'), (size_t)5, "defines: attached and separate forms parsed");
+        assert_equal(defines.get_define("FOO", &value) && value == "3", true, "defines: last wins by default");
+        assert_equal(defines.get_define("FOO", &value, define_policy::first_wins) && value == "1", true, "defines: first wins");
+        assert_equal(defines.get_define("BAR", &value) && value == "two", true, "defines: \"-D name=value\" form");
+        assert_equal(value.data(), (const char *)define_argv[3] + 4, "defines: value points into argv");
+        assert_equal(defines.get_define("BAZ", &value) && value.empty(), true, "defines: name without value");
+        assert_equal(defines.has_define("EMPTY"), true, "defines: empty value");
+        assert_equal(defines.has_define("FO") || defines.has_define("FOO=1"), false, "defines: names match exactly");
+        assert_equal(defines.parse_arg<std::string_view>('o').value() == "a.out", true, "defines: other flags unaffected");
+
+        options copy = defines;
+        copy.set_arg('D', "QUX=9");
+        assert_equal(copy.has_define("FOO"), false, "defines: index rebuilt after editing");
+        assert_equal(copy.get_define("QUX", &value) && value == "9", true, "defines: edited define found");
+        assert_equal(defines.has_define("FOO"), true, "defines: original index kept");
+
+        std::vector<std::string> many;
+        for (int i = 0; i < 5000; ++i)
+            many.push_back("-DNAME" + std::to_string(i) + "=" + std::to_string(i * 2));
+        options many_defines(many);
+        bool all_found = true;
+        for (int i = 0; all_found && i < 5000; ++i)
+        {
+            all_found = many_defines.get_define("NAME" + std::to_string(i), &value) &&
+                value == std::to_string(i * 2);
+        }
+        assert_equal(all_found, true, "defines: every one of many found");
+        assert_equal(many_defines.has_define("NAME5000"), false, "defines: missing among many");
+
+        const frozen_options frozen(defines);
+        assert_equal(frozen.get_define("BAR", &value) && value == "two", true, "defines: frozen lookup");
+
+        std::vector<frozen_options> frozen_copies {frozen, frozen};
+        frozen_copies.push_back(std::move(frozen_copies[0]));
+        assert_equal(frozen_copies[1].get_define("FOO", &value) && value == "3", true, "defines: copied frozen lookup");
+        assert_equal(frozen_copies[2].get_define("BAZ", &value) && value.empty(), true, "defines: moved frozen lookup");
+        assert_equal(frozen_copies[0].get_define("FOO", &value), false, "defines: moved-from frozen has none");
+
+        const std::vector<std::string> swap_tokens {"-DSWAP=1"};
+        options swapped(swap_tokens);
+        swapped.swap(copy);
+        assert_equal(swapped.has_define("QUX") && !swapped.has_define("SWAP"), true, "defines: swapped index follows");
+        assert_equal(copy.has_define("SWAP") && !copy.has_define("QUX"), true, "defines: swapped index follows back");
+
+        constexpr static_options baked(std::array {"-DX=1", "-D", "Y"});
+        static_assert(baked.size() == 2 && baked[0].arg_view() == "X=1", "defines: static_options attaches define args");
+    }
+
+    // Compile-time command lines
+    {
+        constexpr static_options baked(std::array {"program", "-j", "4", "-v", "-n", "-12", "-b", "yes", "input.txt"});
+        static_assert(baked.size() == 6, "static_options: flags paired with args");
+        static_assert(baked.has_flag('j') && !baked.has_flag('x'), "static_options: flag lookup");
+        static_assert(baked.parse_arg<int>('j').value() == 4, "static_options: int arg");
+        static_assert(baked.parse_arg<long>('n').value() == -12, "static_options: negative arg");
+        static_assert(baked.parse_arg<bool>('b').value(), "static_options: bool arg");
+        static_assert(baked.parse_arg<std::string_view>('j').value() == "4", "static_options: string_view arg");
+        static_assert(baked.parse_arg<int>('v').error() == arg_errc::no_argument, "static_options: flag without arg");
+        static_assert(baked.parse_arg<int>('x').error() == arg_errc::missing_flag, "static_options: missing flag");
+        static_assert(baked[5].is_arg_only() && baked[5].index() == 8, "static_options: arg-only option");
+
+        static constexpr const char *baked_tokens[] {"program", "-j", "4", "-v"};
+        constexpr static_options from_array(baked_tokens);
+        static_assert(from_array.size() == 3 && from_array.parse_arg<int>('j').value() == 4, "static_options: c-string array");
+
+        static_assert(parse_traits<signed char>::parse("-128").value() == -128, "parse_integer: minimum fits");
+        static_assert(parse_traits<signed char>::parse("128").error() == arg_errc::out_of_range, "parse_integer: past maximum");
+        static_assert(parse_traits<unsigned>::parse("-1").error() == arg_errc::invalid, "parse_integer: unsigned rejects sign");
+        static_assert(parse_traits<int>::parse(" +7x").value() == 7, "parse_integer: strtol-style prefix and suffix");
+
+        const char *baked_argv[] {"program", "-j", "4", "-v", "-n", "-12", "-b", "yes", "input.txt"};
+        options runtime = baked.to_options();
+        assert_equal(runtime.size(), baked.size(), "static_options: to_options keeps every option");
+        assert_equal(runtime.fingerprint(), options(9, (char **)baked_argv).fingerprint(), "static_options: to_options parses like argv");
+
+        option opt;
+        assert_equal(baked.get_option('n', &opt) && opt.arg_size() == 3, true, "static_options: get_option");
+
+        constexpr static_options baked_cc(std::array {"cc", "-O2", "-Wall", "main.c", "-DNDEBUG=1"});
+        static_assert(baked_cc[1].flag_token() == "-O2" && baked_cc[3].has_attached_arg(), "static_options: flag tokens recorded");
+        const char *cc_argv[] {"cc", "-O2", "-Wall", "main.c", "-DNDEBUG=1"};
+        assert_equal(baked_cc.to_options().fingerprint(), options(5, (char **)cc_argv).fingerprint(), "static_options: flag tokens fingerprint like argv");
+    }
+
+    // Fingerprints and the parse cache
+    {
+        char *first_argv[] {(char *)"proxy", (char *)"-n", (char *)"3", (char *)"-v"};
+        char *same_argv[] {(char *)"proxy", (char *)"-n", (char *)"3", (char *)"-v"};
+        char *other_argv[] {(char *)"proxy", (char *)"-n", (char *)"4", (char *)"-v"};
+        char *shifted_argv[] {(char *)"proxy", (char *)"-n3", (char *)"-v"};
+
+        options first(4, first_argv);
+        assert_equal(first.fingerprint(), options(4, same_argv).fingerprint(), "fingerprint: equal for equal tokens");
+        assert_equal(first.fingerprint(), options::fingerprint(4, first_argv), "fingerprint: static form matches parsed options");
+        assert_equal(first.fingerprint() != options(4, other_argv).fingerprint(), true, "fingerprint: differs when an arg differs");
+        assert_equal(first.fingerprint() != options(3, shifted_argv).fingerprint(), true, "fingerprint: differs when args move");
+        assert_equal(options().fingerprint(), options(0, nullptr).fingerprint(), "fingerprint: empty options agree");
+
+        options edited(4, other_argv);
+        edited.set_arg('n', "3");
+        assert_equal(edited.fingerprint(), first.fingerprint(), "fingerprint: kept up to date by editing");
+
+        options_cache cache(2);
+        std::shared_ptr<const options> cached = cache.get(4, first_argv);
+        assert_equal(cache.get(4, same_argv) == cached, true, "cache: repeated command line is shared");
+        assert_equal(cached->fingerprint(), first.fingerprint(), "cache: cached options keep their fingerprint");
+        option cached_n;
+        cached->get_option('n', &cached_n);
+        assert_equal(cached_n.arg() != first_argv[2] && strcmp(cached_n.arg(), "3") == 0, true, "cache: tokens are copied");
+
+        std::shared_ptr<const options> other = cache.get(4, other_argv);
+        assert_equal(other != cached && other->parse_arg<int>('n').value() == 4, true, "cache: different command line parsed");
+        assert_equal(cache.get(4, first_argv) == cached, true, "cache: hit after another command line");
+        assert_equal(cache.get(3, shifted_argv)->size(), (size_t)3, "cache: third command line parsed");
+        assert_equal(cache.size(), (size_t)2, "cache: bounded by capacity");
+        assert_equal(cache.get(4, first_argv) == cached, true, "cache: recently used command line kept");
+        assert_equal(cache.get(4, other_argv) != other, true, "cache: least recently used command line evicted");
+        assert_equal(other->parse_arg<int>('n').value(), 4, "cache: evicted options stay valid");
+
+        char *o2_argv[] {(char *)"cc", (char *)"-O2", (char *)"main.c"};
+        char *o3_argv[] {(char *)"cc", (char *)"-O3", (char *)"main.c"};
+        options o2(3, o2_argv);
+        assert_equal(o2.fingerprint() != options(3, o3_argv).fingerprint(), true, "fingerprint: covers the whole flag token");
+        assert_equal(o2.fingerprint(), options::fingerprint(3, o2_argv), "fingerprint: static form covers flag tokens");
+        options o2_edited = o2;
+        o2_edited.set_arg('O', "other.c");
+        o2_edited.set_arg('O', "main.c");
+        assert_equal(o2_edited.fingerprint(), o2.fingerprint(), "fingerprint: edits keep flag tokens");
+
+        cache.clear();
+        std::shared_ptr<const options> cached_o2 = cache.get(3, o2_argv);
+        std::shared_ptr<const options> cached_o3 = cache.get(3, o3_argv);
+        assert_equal(cache.get(3, o2_argv) == cached_o2 && cache.get(3, o3_argv) == cached_o3, true,
+                     "cache: flag tokens differing only past the flag are kept apart");
+        assert_equal(cache.size(), (size_t)2, "cache: both flag tokens cached");
+
+        char *null_argv[] {(char *)"proxy", nullptr, (char *)"-v"};
+        std::shared_ptr<const options> cached_null = cache.get(3, null_argv);
+        assert_equal(cached_null->size(), options(3, null_argv).size(), "cache: nullptr tokens parse like argv");
+        assert_equal(cache.get(3, null_argv) == cached_null, true, "cache: nullptr tokens match nullptr");
+        char *filled_argv[] {(char *)"proxy", (char *)"", (char *)"-v"};
+        assert_equal(cache.get(3, filled_argv) != cached_null, true, "cache: nullptr does not match a token");
+
+        cache.clear();
+        assert_equal(cache.size(), (size_t)0, "cache: cleared");
+
+        reloadable_options holder{options(4, first_argv)};
+        assert_equal(holder.publish_if_changed(options(4, same_argv)), false, "publish_if_changed: skips unchanged options");
+        assert_equal(holder.retired(), (size_t)0, "publish_if_changed: nothing retired when skipped");
+        assert_equal(holder.publish_if_changed(options(4, other_argv)), true, "publish_if_changed: publishes changed options");
+        assert_equal(holder.acquire()->parse_arg<int>('n').value(), 4, "publish_if_changed: new options visible");
+    }
+
+    // Frozen snapshot
+    {
+        const frozen_options frozen(opts);
+        int number = -1;
+        int err = -1;
+        bool result;
+
+        assert_equal(frozen.opts().size(), opts.size(), "frozen: holds every option");
+        assert_equal(frozen.has_flag('n'), true, "frozen: has flag 'n'");
+        assert_equal(frozen.has_flag('l'), false, "frozen: does not have flag 'l'");
+
+        result = frozen.get_arg('n', &number, &err);
+        assert_equal(result, true, "frozen: int returns true on successful parse");
+        assert_equal(number, 10, "frozen: int parsed from arg");
+        assert_equal(err, 0, "frozen: err is 0 on success");
+
+        errno = 0;
+        number = -1;
+        result = frozen.get_arg('o', &number, &err);
+        assert_equal(result, false, "frozen: int returns false on non-int");
+        assert_equal(number, -1, "frozen: int un-mutated on false");
+        assert_equal(err, EINVAL, "frozen: err is EINVAL on non-int");
+        assert_equal(errno, 0, "frozen: errno is untouched");
+
+        float f = -1.f;
+        result = frozen.get_arg('q', &f, &err);
+        assert_equal(result, false, "frozen: float returns false when out of range");
+        assert_equal(err, ERANGE, "frozen: err is ERANGE when out of range");
+
+        bool check = false;
+        result = frozen.get_arg('b', &check);
+        assert_equal(result && check, true, "frozen: bool \"yes\" gets true");
+
+        const char *str = nullptr;
+        frozen.get_arg('o', &str);
+        assert_equal(str, "test_file.txt", "frozen: finds parameter string");
+
+        option opt;
+        result = frozen.get_option('h', &opt);
+        assert_equal(result && opt.index() == 20, true, "frozen: get_option finds first option");
+    }
+
+    // Reloadable options
+    {
+        const char *first_argv[] {"program", "-n", "1"};
+        const char *second_argv[] {"program", "-n", "2"};
+        reloadable_options holder(options(3, (char **)first_argv));
+        int number = -1;
+
+        {
+            reloadable_options::snapshot before = holder.acquire();
+            holder.publish(options(3, (char **)second_argv));
+
+            before->get_arg('n', &number);
+            assert_equal(number, 1, "reloadable: held snapshot keeps old options");
+            assert_equal(holder.retired(), (size_t)1, "reloadable: held options not reclaimed");
+
+            reloadable_options::snapshot after = holder.acquire();
+            after->get_arg('n', &number);
+            assert_equal(number, 2, "reloadable: new snapshot sees published options");
+        }
+
+        holder.reclaim();
+        assert_equal(holder.retired(), (size_t)0, "reloadable: released options reclaimed");
+    }
+
+    // Layered sources: argv, then environment, then config file
+    {
+        FILE *cfg = fopen("options_test.cfg", "w");
+        fputs("# comment\n"
+              "o = config_file.txt\n"
+              "x=from_config\n"
+              "  y  \n"
+              "bad line\n"
+              "z=last", cfg); // no trailing newline
+        fclose(cfg);
+
+        setenv("OPTIONS_TEST_x", "from_env", 1);
+        setenv("OPTIONS_TEST_w", "", 1);
+
+        char *layered_argv[] {(char *)"program", (char *)"-o", (char *)"argv_file.txt"};
+        options layered(3, layered_argv, "OPTIONS_TEST", "options_test.cfg");
+
+        remove("options_test.cfg");
+
+        const char *str = nullptr;
+        option opt;
+        layered.get_arg('o', &str);
+        assert_equal(str, "argv_file.txt", "layers: argv overrides config");
+        layered.get_option('o', &opt);
+        assert_equal(opt.source() == option_source::argv, true, "layers: argv option records its source");
+
+        layered.get_arg('x', &str);
+        assert_equal(str, "from_env", "layers: environment overrides config");
+        layered.get_option('x', &opt);
+        assert_equal(opt.source() == option_source::environment, true, "layers: env option records its source");
+        assert_equal(opt.index(), -1, "layers: env option has no argv index");
+
+        assert_equal(layered.get_option('w', &opt) && opt.is_flag_only(), true, "layers: empty env var is a flag");
+
+        layered.get_option('y', &opt);
+        assert_equal(opt.source() == option_source::config_file, true, "layers: config option records its source");
+        assert_equal(opt.is_flag_only(), true, "layers: config key without value is a flag");
+
+        layered.get_arg('z', &str);
+        assert_equal(str, "last", "layers: config value at end of file");
+        assert_equal(layered.has_flag('b'), false, "layers: malformed config line skipped");
+
+        assert_equal(layered.fingerprint() != options(3, layered_argv).fingerprint(), true, "layers: fingerprint covers every layer");
+        options refingerprinted = layered;
+        refingerprinted.insert(0, 'k');
+        refingerprinted.remove('k');
+        assert_equal(refingerprinted.fingerprint(), layered.fingerprint(), "layers: edits fingerprint like parsing does");
+
+        assert_equal(layered.get_last_option('o', &opt) && strcmp(opt.arg(), "argv_file.txt") == 0, true,
+                     "layers: last option comes from the first layer");
+        assert_equal(layered.count('o'), (size_t)1, "layers: count sees the first layer");
+        assert_equal(layered.get_option('o', 1, &opt), false, "layers: nth option stays in the first layer");
+        assert_equal(layered.occurrences('x').size(), (size_t)1, "layers: occurrences see the first layer");
+        assert_equal(layered.occurrences('z').size() == 1 && layered.occurrences('z')[0].source() == option_source::config_file,
+                     true, "layers: flag only in config found there");
+
+        options x_options;
+        layered.get_options('x', &x_options);
+        assert_equal(x_options.size(), (size_t)2, "layers: every layer's options are kept");
+
+        setenv("OPTIONS_TEST_x", "changed_env", 1);
+        assert_equal(layered.parse_arg<std::string_view>('x').value() == "from_env", true,
+                     "layers: env value copied, not borrowed from getenv");
+        unsetenv("OPTIONS_TEST_x");
+        unsetenv("OPTIONS_TEST_w");
+    }
+
     // Log
     {
         opts.log(stdout);
@@ -349,10 +1080,12 @@ int test_main(int argc, char *argv[])
     printf("\nTotal %i/%i tests passed.\n", tests_passed, tests_ran);
 
     if (tests_passed < tests_ran)
+    {
         printf("Tests failed:\n%s", errors.str().c_str());
-    else
-        printf("All tests passed!\n");
+        return 1;
+    }
 
+    printf("All tests passed!\n");
     return 0;
 }
 
@@ -0,0 +1,178 @@
+// Concurrency test, built with -fsanitize=thread.
+// Any data race in the read paths below is reported by ThreadSanitizer and
+// fails the test.
+#include "options.hpp"
+#include "options_cache.hpp"
+#include "options_reload.hpp"
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+static std::atomic<int> failures;
+
+static void check(bool condition, const char *test_name)
+{
+    if (!condition)
+    {
+        ++failures;
+        fprintf(stderr, "=====> [%s] FAILED\n", test_name);
+    }
+}
+
+static void read_frozen(const frozen_options &frozen)
+{
+    for (int n = 0; n < 500; ++n)
+    {
+        // a sentinel errno proves that reads leave it alone
+        errno = 12345;
+
+        long l = 0;
+        check(frozen.get_arg('n', &l) && l == 10, "frozen: long read");
+
+        int i = 0, err = 0;
+        check(!frozen.get_arg('o', &i, &err) && err == EINVAL, "frozen: invalid int read");
+        check(!frozen.get_arg('q', &i, &err) && err == ERANGE, "frozen: out of range int read");
+
+        bool b = false;
+        check(frozen.get_arg('b', &b) && b, "frozen: bool read");
+
+        double d = 0;
+        check(frozen.get_arg('d', &d) && d == 2.5, "frozen: double read");
+
+        std::string_view view;
+        check(frozen.get_arg('o', &view) && view == "file.txt", "frozen: string_view read");
+        check(!frozen.has_flag('z'), "frozen: missing flag");
+
+        check(errno == 12345, "frozen: errno untouched by reads");
+    }
+}
+
+static void read_reloadable(const reloadable_options &holder)
+{
+    for (int iteration = 0; iteration < 500; ++iteration)
+    {
+        reloadable_options::snapshot snap = holder.acquire();
+
+        // both flags are published together, so a torn read shows up here
+        long n = -1, m = -2;
+        snap->get_arg('n', &n);
+        snap->get_arg('m', &m);
+        check(n == m, "reloadable: snapshot is consistent");
+        std::this_thread::yield();
+    }
+}
+
+static void read_defines(const options &opts)
+{
+    // every thread races to build the index on its first lookup
+    std::string_view value;
+    check(opts.get_define("B", &value) && value == "2", "defines: lookup while the index is built");
+    check(!opts.has_define("C"), "defines: missing define");
+
+    // a copy taken while the index is built shares it or builds its own
+    const options copy = opts;
+    check(copy.get_define("A", &value) && value == "1", "defines: lookup in a copy");
+}
+
+static void read_cache(options_cache &cache, char **argv_a, char **argv_b)
+{
+    for (int iteration = 0; iteration < 500; ++iteration)
+    {
+        char **argv = iteration % 2 ? argv_a : argv_b;
+        std::shared_ptr<const options> opts = cache.get(3, argv);
+
+        long n = -1;
+        check(opts->get_arg('n', &n) && n == (iteration % 2 ? 1 : 2), "cache: shared options read");
+    }
+}
+
+int main()
+{
+    const char *argv[] {
+        "program",
+        "-o", "file.txt",
+        "-n", "10",
+        "-q", "99999999999999999999",
+        "-b", "yes",
+        "-d", "2.5",
+    };
+
+    const frozen_options frozen(options(11, (char **)argv));
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 64; ++i)
+        threads.emplace_back(read_frozen, std::cref(frozen));
+    for (std::thread &t : threads)
+        t.join();
+
+    // Reloads while 63 readers pin snapshots
+    {
+        static char numbers[200][8];
+        static char *reload_argv[200][5];
+        for (int i = 0; i < 200; ++i)
+        {
+            snprintf(numbers[i], sizeof(numbers[i]), "%i", i);
+            reload_argv[i][0] = (char *)"program";
+            reload_argv[i][1] = (char *)"-n";
+            reload_argv[i][2] = numbers[i];
+            reload_argv[i][3] = (char *)"-m";
+            reload_argv[i][4] = numbers[i];
+        }
+
+        reloadable_options holder(options(5, reload_argv[0]));
+
+        std::vector<std::thread> readers;
+        for (int i = 0; i < 63; ++i)
+            readers.emplace_back(read_reloadable, std::cref(holder));
+
+        for (int i = 1; i < 200; ++i)
+        {
+            holder.publish(options(5, reload_argv[i]));
+            std::this_thread::yield();
+        }
+
+        for (std::thread &t : readers)
+            t.join();
+
+        holder.reclaim();
+        check(holder.retired() == 0, "reloadable: everything reclaimed after readers finish");
+    }
+
+    // First define lookups from many threads at once
+    for (int round = 0; round < 20; ++round)
+    {
+        const char *define_argv[] {"program", "-DA=1", "-DB=2"};
+        const options opts(3, (char **)define_argv);
+
+        std::vector<std::thread> readers;
+        for (int i = 0; i < 16; ++i)
+            readers.emplace_back(read_defines, std::cref(opts));
+        for (std::thread &t : readers)
+            t.join();
+    }
+
+    // Many threads hitting and filling one cache
+    {
+        const char *argv_a[] {"program", "-n", "1"};
+        const char *argv_b[] {"program", "-n", "2"};
+        options_cache cache(1);
+
+        std::vector<std::thread> users;
+        for (int i = 0; i < 32; ++i)
+            users.emplace_back(read_cache, std::ref(cache), (char **)argv_a, (char **)argv_b);
+        for (std::thread &t : users)
+            t.join();
+
+        check(cache.size() == 1, "cache: bounded under contention");
+    }
+
+    if (failures)
+    {
+        printf("%i concurrency checks failed.\n", failures.load());
+        return 1;
+    }
+
+    printf("All concurrency tests passed!\n");
+    return 0;
+}